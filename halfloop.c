@@ -1,5 +1,13 @@
 // compile and run: g++ -Ofast -fopenmp halfloop.c -std=c++20 -Wall -Wextra -Wpedantic -march=native; ./a.out
-// dependency: CPU with AVX-256 support
+// portable: g++ -Ofast -fopenmp halfloop.c -std=c++20 -Wall -Wextra -Wpedantic  (any x86-64 CPU, the
+//           subset operations pick AVX-512, AVX2 or baseline code at start up, see STEP3_ISA)
+// optional: ./a.out build-cache  (precompute the step 2 tables once, see TABLE_CACHE)
+// options:  ./a.out --help         (all run time options and their defaults)
+// sharded:  ./a.out --data=d.bin --n_shards=n --shard=k --checkpoint=ck_k.bin  (for k = 0, ..., n-1)
+// candidates: ./a.out --candidates=c.jsonl --candidates_format=jsonl  (streamed while step 3 runs)
+// profile:  ./a.out --perf=1  (hardware counters of step 2 and step 3 per thread and per guess)
+// bench:    ./a.out bench [name ...] --bench_mode=latency --bench_format=jsonl  (cipher and subset primitives)
+// figures:  ./a.out rk8-candidates hist.csv --rk8_candidates_format=csv  (distributions of |RK^{(8)}_j|)
 
 #include <iostream>
 #include <omp.h>
@@ -8,6 +16,29 @@
 #include <unistd.h>
 #include <vector>
 #include <immintrin.h>
+#include <atomic>
+#include <iomanip>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <new>
+#include <span>
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <tuple>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 typedef uint8_t u8;
 typedef uint16_t u16;
@@ -15,31 +46,267 @@ typedef uint32_t u32;
 typedef uint64_t u64;
 typedef __uint128_t u128;
 
+// without -march=native (or another target with AVX2) the subset operations
+// of step 3 are compiled for several instruction sets and the ones of the CPU
+// are picked at startup (see subset_backend_t)
+#ifndef __AVX2__
+#define STEP3_ISA_DISPATCH
+#endif
+
 using namespace std::chrono;
 using namespace std::chrono_literals;
 
-// compile time flags: 1 = True
-// check correct value of (rk10, rk9) in the first iteration
-#define CHECK_CORRECT_FIRST 0
-// count various stuff (to experimentally verify our analysis)
-// set to zero when benchmarking the performance!
-#define COUNTERS 1
-// use omp to parallelize attack
-#define PARALLEL 1
-
-// compile time const
-// only check subset of {(rk10, rk9)} where
-// rk10 < MAX_RK10 and rk9 < MAX_RK9
-// -> complexity is MAX_RK10*MAX_RK9 <= 2**48
-// for real attack use MAX_RK10 = MAX_RK9 = 0x1000000
-const u64 MAX_RK10 = 0x010000;
-const u64 MAX_RK9  = 0x010000;
-const u64 REP  = 5;
+// run time configuration
+// set with --NAME=value or --NAME value on the command line (NAME is case
+// insensitive, '-' and '_' are equivalent) or with NAME = value lines in a
+// config file given by --config=file (# starts a comment)
+// booleans: 1 = True
+const int MAX_N_PAIRS = 8;
+const int STEP3_MAX_PREFETCH = 8;
+const u32 ORACLE_MAX_BATCH = 1 << 20; // queries per request (see oracle_request_t)
+struct config_t{
+  // check correct value of (rk10, rk9) first
+  // (and the correct remaining key bits first in step 4)
+  bool check_correct_first = false;
+  // count various stuff (to experimentally verify our analysis)
+  // set to zero when benchmarking the performance!
+  bool counters = true;
+  // use omp to parallelize attack
+  bool parallel = true;
+  // map the step 2 tables from TABLE_CACHE_DIR (see build_table_cache)
+  // instead of building them in every run
+  bool table_cache = false;
+  // store T as 24 bit indices into dictionaries of distinct subsets
+  // (about half the memory of the full T, see compress_T)
+  bool compressed_t = false;
+  // put the big tables on 1 GiB or 2 MiB huge pages if possible (see arena_t),
+  // cached tables are then read into memory instead of being mmap'ed
+  bool huge_pages = true;
+  // only check subset of {(rk10, rk9)} where
+  // rk10 < MAX_RK10 and rk9 < MAX_RK9
+  // -> complexity is MAX_RK10*MAX_RK9 <= 2**48
+  // for real attack use MAX_RK10 = MAX_RK9 = 0x1000000
+  u64 max_rk10 = 0x010000;
+  u64 max_rk9  = 0x010000;
+  // and rk10 >= RK10_BEGIN, rk9 >= RK9_BEGIN; the rows RK10_BEGIN <= rk10 < MAX_RK10
+  // are split into N_SHARDS shards of which only shard SHARD is checked
+  // (to distribute one attack on many machines, see also DATA)
+  u64 rk10_begin = 0;
+  u64 rk9_begin = 0;
+  u64 shard = 0;
+  u64 n_shards = 1;
+  u64 rep = 5;
+  // number of pairs used in step 3, 1 <= N_PAIRS <= MAX_N_PAIRS
+  u64 n_pairs = 3;
+  // evaluation of the step 3 guesses: scalar, simd or memo (see step3_kernel_t)
+  std::string step3_kernel = "memo";
+  // instruction set of step 3: auto, avx512, avx2 or baseline (see isa_t),
+  // only auto when compiled with -march=native (without it this picks the
+  // subset operations, see subset_backend_t)
+  std::string step3_isa = "auto";
+  // order of the pairs in the rk8 filter of step 3: fixed (index order) or
+  // sampled (by rejection power, see step3_filter_order)
+  std::string step3_filter_order = "sampled";
+  // simd and memo kernel: the T rows of a block of guesses are prefetched
+  // STEP3_PREFETCH blocks before they are used (0 = no prefetching)
+  u64 step3_prefetch = 2;
+  // step 4: only check subset of the 2**48 remaining keys where the unknown
+  // 16 bits of L^-1(rk7) are < MAX_RK7 and rk6 < MAX_RK6
+  // for real attack use MAX_RK7 = 0x10000 and MAX_RK6 = 0x1000000
+  u64 max_rk7 = 0x000100;
+  u64 max_rk6 = 0x000100;
+  // number of additional queries to verify a recovered key
+  u64 n_verify = 4;
+  // written by ./a.out build-cache
+  std::string table_cache_dir = "tables";
+  // key and pairs are read from DATA if it exists and written to it otherwise
+  // (all shards of one attack need the same DATA)
+  std::string data = "";
+  // the finished rows of step 3 and their candidates are written to CHECKPOINT
+  // every CHECKPOINT_INTERVAL seconds, an existing CHECKPOINT is resumed
+  std::string checkpoint = "";
+  u64 checkpoint_interval = 600;
+  // the step 3 candidates are streamed to CANDIDATES while the search runs
+  // (see candidate_sink_t) instead of being kept in memory and in CHECKPOINT,
+  // step 4 reads them back, CANDIDATES_FORMAT is bin or jsonl
+  std::string candidates = "";
+  std::string candidates_format = "bin";
+  // report the progress of step 3 (tiles, guesses/s and ETA, see
+  // step3_progress_t) and its funnel (see step3_stats_t) every STATS_INTERVAL
+  // seconds, the funnel also at the end of step 3
+  u64 stats_interval = 60;
+  // count cycles, instructions, cache, TLB and branch misses of step 2 and 3
+  // per thread with perf_event_open (see perf_counters_t)
+  bool perf = false;
+  // Unix domain socket of the encryption oracle (./a.out oracle): the
+  // queries of step 1 and 4 are then sent to it in batches and the key is
+  // unknown to the attack (a DATA written by such a run has the key 0)
+  std::string oracle = "";
+  // queries per batch of ./a.out bench oracle (throughput mode)
+  u64 oracle_batch = 4096;
+  // ./a.out bench: BENCH_MODE is throughput or latency, BENCH_FORMAT is text
+  // or jsonl, median of BENCH_REP runs of BENCH_N calls (see bench_t)
+  std::string bench_mode = "throughput";
+  std::string bench_format = "text";
+  u64 bench_n = 1 << 20;
+  u64 bench_rep = 11;
+  // ./a.out rk8-candidates FILE: the histograms are written to FILE as csv or json
+  std::string rk8_candidates_format = "csv";
+};
+config_t CONFIG;
+
+// one entry per option, exactly one of b, n, s is set
+struct config_option_t{
+  const char *name;
+  bool *b;
+  u64 *n;
+  std::string *s;
+  u64 min, max; // range for n
+};
+
+std::vector<config_option_t> config_options(config_t &cfg){
+  return {
+    {"CHECK_CORRECT_FIRST", &cfg.check_correct_first, nullptr, nullptr, 0, 0},
+    {"COUNTERS", &cfg.counters, nullptr, nullptr, 0, 0},
+    {"PARALLEL", &cfg.parallel, nullptr, nullptr, 0, 0},
+    {"TABLE_CACHE", &cfg.table_cache, nullptr, nullptr, 0, 0},
+    {"COMPRESSED_T", &cfg.compressed_t, nullptr, nullptr, 0, 0},
+    {"HUGE_PAGES", &cfg.huge_pages, nullptr, nullptr, 0, 0},
+    {"MAX_RK10", nullptr, &cfg.max_rk10, nullptr, 1, 1 << 24},
+    {"MAX_RK9", nullptr, &cfg.max_rk9, nullptr, 1, 1 << 24},
+    {"RK10_BEGIN", nullptr, &cfg.rk10_begin, nullptr, 0, (1 << 24) - 1},
+    {"RK9_BEGIN", nullptr, &cfg.rk9_begin, nullptr, 0, (1 << 24) - 1},
+    {"SHARD", nullptr, &cfg.shard, nullptr, 0, (1 << 24) - 1},
+    {"N_SHARDS", nullptr, &cfg.n_shards, nullptr, 1, 1 << 24},
+    {"REP", nullptr, &cfg.rep, nullptr, 0, ~0ull},
+    {"N_PAIRS", nullptr, &cfg.n_pairs, nullptr, 1, MAX_N_PAIRS},
+    {"STEP3_KERNEL", nullptr, nullptr, &cfg.step3_kernel, 0, 0},
+    {"STEP3_ISA", nullptr, nullptr, &cfg.step3_isa, 0, 0},
+    {"STEP3_FILTER_ORDER", nullptr, nullptr, &cfg.step3_filter_order, 0, 0},
+    {"STEP3_PREFETCH", nullptr, &cfg.step3_prefetch, nullptr, 0, STEP3_MAX_PREFETCH},
+    {"MAX_RK7", nullptr, &cfg.max_rk7, nullptr, 1, 1 << 16},
+    {"MAX_RK6", nullptr, &cfg.max_rk6, nullptr, 1, 1 << 24},
+    {"N_VERIFY", nullptr, &cfg.n_verify, nullptr, 0, ~0ull},
+    {"TABLE_CACHE_DIR", nullptr, nullptr, &cfg.table_cache_dir, 0, 0},
+    {"DATA", nullptr, nullptr, &cfg.data, 0, 0},
+    {"CHECKPOINT", nullptr, nullptr, &cfg.checkpoint, 0, 0},
+    {"CHECKPOINT_INTERVAL", nullptr, &cfg.checkpoint_interval, nullptr, 1, ~0ull},
+    {"CANDIDATES", nullptr, nullptr, &cfg.candidates, 0, 0},
+    {"CANDIDATES_FORMAT", nullptr, nullptr, &cfg.candidates_format, 0, 0},
+    {"STATS_INTERVAL", nullptr, &cfg.stats_interval, nullptr, 1, ~0ull},
+    {"PERF", &cfg.perf, nullptr, nullptr, 0, 0},
+    {"ORACLE", nullptr, nullptr, &cfg.oracle, 0, 0},
+    {"ORACLE_BATCH", nullptr, &cfg.oracle_batch, nullptr, 1, ORACLE_MAX_BATCH},
+    {"BENCH_MODE", nullptr, nullptr, &cfg.bench_mode, 0, 0},
+    {"BENCH_FORMAT", nullptr, nullptr, &cfg.bench_format, 0, 0},
+    {"BENCH_N", nullptr, &cfg.bench_n, nullptr, 1, ~0ull},
+    {"BENCH_REP", nullptr, &cfg.bench_rep, nullptr, 1, ~0ull},
+    {"RK8_CANDIDATES_FORMAT", nullptr, nullptr, &cfg.rk8_candidates_format, 0, 0},
+  };
+}
+
+bool config_read_file(config_t &cfg, const std::string &path);
+
+// set option name to value, returns false (and complains) on bad input
+bool config_set(config_t &cfg, std::string name, const std::string &value){
+  for(char &c : name) c = (c == '-') ? '_' : toupper(c);
+  if(name == "CONFIG") return config_read_file(cfg, value);
+  for(const config_option_t &o : config_options(cfg)){
+    if(name != o.name) continue;
+    if(o.s != nullptr){
+      *o.s = value;
+      return true;
+    }
+    char *end;
+    errno = 0;
+    u64 n = strtoull(value.c_str(), &end, 0);
+    bool ok = !value.empty() && *end == '\0' && errno == 0;
+    if(o.b != nullptr){
+      if(value == "true") n = 1, ok = true;
+      if(value == "false") n = 0, ok = true;
+      if(ok && n <= 1){
+        *o.b = n;
+        return true;
+      }
+    } else if(ok && n >= o.min && n <= o.max){
+      *o.n = n;
+      return true;
+    }
+    std::cout << "Bad value for " << o.name << ": " << value << std::endl;
+    return false;
+  }
+  std::cout << "Unknown option: " << name << std::endl;
+  return false;
+}
+
+bool config_read_file(config_t &cfg, const std::string &path){
+  std::ifstream f(path);
+  if(!f){
+    std::cout << "Cannot read config file " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  while(std::getline(f, line)){
+    line = line.substr(0, line.find('#'));
+    size_t eq = line.find('=');
+    auto trim = [](const std::string &s){
+      size_t b = s.find_first_not_of(" \t\r"), e = s.find_last_not_of(" \t\r");
+      return (b == std::string::npos) ? std::string() : s.substr(b, e - b + 1);
+    };
+    if(trim(line).empty()) continue;
+    if(eq == std::string::npos || !config_set(cfg, trim(line.substr(0, eq)), trim(line.substr(eq + 1)))){
+      std::cout << "Bad line in " << path << ": " << line << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// parse the options in argv, everything else (mode and its arguments) goes to args
+bool parse_config(config_t &cfg, int argc, char **argv, std::vector<std::string> &args){
+  for(int k = 1; k < argc; k++){
+    std::string a = argv[k];
+    if(a == "--help" || a == "-h") return false;
+    if(a.rfind("--", 0) != 0){
+      args.push_back(a);
+      continue;
+    }
+    size_t eq = a.find('=');
+    if(eq != std::string::npos){
+      if(!config_set(cfg, a.substr(2, eq - 2), a.substr(eq + 1))) return false;
+    } else if(k + 1 < argc){
+      if(!config_set(cfg, a.substr(2), argv[++k])) return false;
+    } else {
+      std::cout << "Missing value for " << a << std::endl;
+      return false;
+    }
+  }
+  if(cfg.rk10_begin >= cfg.max_rk10 || cfg.rk9_begin >= cfg.max_rk9){
+    std::cout << "Need RK10_BEGIN < MAX_RK10 and RK9_BEGIN < MAX_RK9" << std::endl;
+    return false;
+  }
+  if(cfg.shard >= cfg.n_shards || cfg.n_shards > cfg.max_rk10 - cfg.rk10_begin){
+    std::cout << "Need SHARD < N_SHARDS <= MAX_RK10 - RK10_BEGIN" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void print_config(config_t &cfg){
+  std::cout << "FLAGS: " << std::endl;
+  for(const config_option_t &o : config_options(cfg)){
+    std::cout << "  - " << o.name << ": ";
+    if(o.b != nullptr) std::cout << *o.b;
+    else if(o.n != nullptr) std::cout << std::dec << *o.n;
+    else std::cout << *o.s;
+    std::cout << std::endl;
+  }
+}
 
 /////////////////////////////////////////
 // START OF HALFLOOP-24 IMPLEMENTATION //
 /////////////////////////////////////////
-static const u8 SBOX[256] = {
+static constexpr u8 SBOX[256] = {
   0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
   0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
   0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
@@ -57,7 +324,7 @@ static const u8 SBOX[256] = {
   0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
   0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16};
 
-static const u8 inv_SBOX[256] = {
+static constexpr u8 inv_SBOX[256] = {
     0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
     0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
     0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
@@ -75,7 +342,7 @@ static const u8 inv_SBOX[256] = {
     0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
     0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
 };
-u32 sub_bytes(u32 state){
+constexpr u32 sub_bytes(u32 state){
   u8 a0 = state >> 16;
   u8 a1 = (state >> 8) & 0xFF;
   u8 a2 = state & 0xFF;
@@ -83,7 +350,7 @@ u32 sub_bytes(u32 state){
   return state;
 }
 
-u32 inv_sub_bytes(u32 state){
+constexpr u32 inv_sub_bytes(u32 state){
   u8 a0 = state >> 16;
   u8 a1 = (state >> 8) & 0xFF;
   u8 a2 = state & 0xFF;
@@ -91,7 +358,7 @@ u32 inv_sub_bytes(u32 state){
   return state;
 }
 
-u32 rotate_rows(u32 state){
+constexpr u32 rotate_rows(u32 state){
   u8 a0 = state >> 16;
   u8 a1 = (state >> 8) & 0xFF;
   u8 a2 = state & 0xFF;
@@ -101,7 +368,7 @@ u32 rotate_rows(u32 state){
   return state;
 }
 
-u32 inv_rotate_rows(u32 state){
+constexpr u32 inv_rotate_rows(u32 state){
   u8 a0 = state >> 16;
   u8 a1 = (state >> 8) & 0xFF;
   u8 a2 = state & 0xFF;
@@ -111,7 +378,7 @@ u32 inv_rotate_rows(u32 state){
   return state;
 }
 
-u32 mix_columns(u32 state){
+constexpr u32 mix_columns(u32 state){
   u32 s = 0;
   s |= (((state >> 0) ^ (state >> 5) ^ (state >> 15) ^ (state >> 16)) & 0x1) << 0;
   s |= (((state >> 1) ^ (state >> 5) ^ (state >> 6) ^ (state >> 8) ^ (state >> 15) ^ (state >> 17)) & 0x1) << 1;
@@ -140,7 +407,7 @@ u32 mix_columns(u32 state){
   return s;
 }
 
-u32 inv_mix_columns(u32 state){
+constexpr u32 inv_mix_columns(u32 state){
   u32 s = 0;
   s |= (((state >> 6) ^ (state >> 7) ^ (state >> 8) ^ (state >> 11) ^ (state >> 14) ^ (state >> 21)) & 0x1) << 0;
   s |= (((state >> 0) ^ (state >> 6) ^ (state >> 8) ^ (state >> 9) ^ (state >> 11) ^ (state >> 12) ^ (state >> 14) ^ (state >> 15) ^ (state >> 21) ^ (state >> 22)) & 0x1) << 1;
@@ -169,82 +436,68 @@ u32 inv_mix_columns(u32 state){
   return s;
 }
 
-// LUT for linear layer
-// these are filled in the generate_tables
-static u8 LUT_L_INV_MSB_0[256] = {0};
-static u8 LUT_L_INV_MSB_1[256] = {0};
-static u8 LUT_L_INV_MSB_2[256] = {0};
-static u8 LUT_L_INV_MIDDLESB_0[256] = {0};
-static u8 LUT_L_INV_MIDDLESB_1[256] = {0};
-static u8 LUT_L_INV_MIDDLESB_2[256] = {0};
-static u8 LUT_L_INV_LSB_0[256] = {0};
-static u8 LUT_L_INV_LSB_1[256] = {0};
-static u8 LUT_L_INV_LSB_2[256] = {0};
-static u8 LUT_L_MSB_0[256] = {0};
-static u8 LUT_L_MSB_1[256] = {0};
-static u8 LUT_L_MSB_2[256] = {0};
-static u8 LUT_L_MIDDLESB_0[256] = {0};
-static u8 LUT_L_MIDDLESB_1[256] = {0};
-static u8 LUT_L_MIDDLESB_2[256] = {0};
-static u8 LUT_L_LSB_0[256] = {0};
-static u8 LUT_L_LSB_1[256] = {0};
-static u8 LUT_L_LSB_2[256] = {0};
-static u32 LUT_L_FROM_MSB[256] = {0};
+// LUTs generated at compile time for functions that are the XOR of one
+// lookup per byte j of the 24 bit input (byte 0 is the MSB), e.g. the linear
+// layer costs 3 lookups and 2 XORs; the simd kernels evaluate many states at
+// once with gathers from them (see step3_front_simd)
+typedef std::array<std::array<u32, 256>, 3> lut32_t;
 
-static inline u8 L_INV_MSB(u32 s){
-  return LUT_L_INV_MSB_2[(u8) s] ^ LUT_L_INV_MSB_1[(u8) (s >> 8)] ^ LUT_L_INV_MSB_0[(u8) (s >> 16)];
-}
-static inline u8 L_INV_MIDDLESB(u32 s){
-  return LUT_L_INV_MIDDLESB_2[(u8) s] ^ LUT_L_INV_MIDDLESB_1[(u8) (s >> 8)] ^ LUT_L_INV_MIDDLESB_0[(u8) (s >> 16)];
-}
-static inline u8 L_INV_LSB(u32 s){
-  return LUT_L_INV_LSB_2[(u8) s] ^ LUT_L_INV_LSB_1[(u8) (s >> 8)] ^ LUT_L_INV_LSB_0[(u8) (s >> 16)];
-}
-static inline u32 inv_linear_layer(u32 s){
-  return L_INV_LSB(s) ^ (L_INV_MIDDLESB(s) << 8) ^ (L_INV_MSB(s) << 16);
+// F(s, shift) is the output for the input s << shift
+template<typename F>
+constexpr lut32_t make_lut32(F f){
+  lut32_t LUT = {};
+  for(int j = 0; j < 3; j++){
+    const u32 shift = 16 - 8*j;
+    for(u32 s = 0; s < 256; s++) LUT[j][s] = f(s, shift);
+  }
+  return LUT;
 }
 
-static inline u8 L_MSB(u32 s){
-  return LUT_L_MSB_2[(u8) s] ^ LUT_L_MSB_1[(u8) (s >> 8)] ^ LUT_L_MSB_0[(u8) (s >> 16)];
-}
-static inline u8 L_MIDDLESB(u32 s){
-  return LUT_L_MIDDLESB_2[(u8) s] ^ LUT_L_MIDDLESB_1[(u8) (s >> 8)] ^ LUT_L_MIDDLESB_0[(u8) (s >> 16)];
-}
-static inline u8 L_LSB(u32 s){
-  return LUT_L_LSB_2[(u8) s] ^ LUT_L_LSB_1[(u8) (s >> 8)] ^ LUT_L_LSB_0[(u8) (s >> 16)];
-}
-static inline u32 linear_layer(u32 s){
-  return L_LSB(s) ^ (L_MIDDLESB(s) << 8) ^ (L_MSB(s) << 16);
+constexpr u32 lut32_lookup(const lut32_t &LUT, u32 s){
+  return LUT[0][(u8) (s >> 16)] ^ LUT[1][(u8) (s >> 8)] ^ LUT[2][(u8) s];
 }
 
-void generate_tables(){
-  // Build LUTs
-  for(u32 s = 0; s < 0x100; s++){
-    LUT_L_INV_MSB_2[s] =      ((u8) (inv_rotate_rows(inv_mix_columns(s <<  0)) >> 16));
-    LUT_L_INV_MSB_1[s] =      ((u8) (inv_rotate_rows(inv_mix_columns(s <<  8)) >> 16));
-    LUT_L_INV_MSB_0[s] =      ((u8) (inv_rotate_rows(inv_mix_columns(s << 16)) >> 16));
-    LUT_L_INV_MIDDLESB_2[s] = ((u8) (inv_rotate_rows(inv_mix_columns(s <<  0)) >>  8));
-    LUT_L_INV_MIDDLESB_1[s] = ((u8) (inv_rotate_rows(inv_mix_columns(s <<  8)) >>  8));
-    LUT_L_INV_MIDDLESB_0[s] = ((u8) (inv_rotate_rows(inv_mix_columns(s << 16)) >>  8));
-    LUT_L_INV_LSB_2[s] =      ((u8) (inv_rotate_rows(inv_mix_columns(s <<  0)) >>  0));
-    LUT_L_INV_LSB_1[s] =      ((u8) (inv_rotate_rows(inv_mix_columns(s <<  8)) >>  0));
-    LUT_L_INV_LSB_0[s] =      ((u8) (inv_rotate_rows(inv_mix_columns(s << 16)) >>  0));
+// linear_layer
+static constexpr lut32_t LUT_L_32 = make_lut32([](u32 s, u32 shift){ return mix_columns(rotate_rows(s << shift)); });
+// inv_linear_layer
+static constexpr lut32_t LUT_L_INV_32 = make_lut32([](u32 s, u32 shift){ return inv_rotate_rows(inv_mix_columns(s << shift)); });
+// inv_sub_bytes
+static constexpr lut32_t LUT_INV_SBOX_32 = make_lut32([](u32 s, u32 shift){ return (u32) inv_SBOX[s] << shift; });
+// inv_linear_layer(inv_sub_bytes)
+static constexpr lut32_t LUT_INV_SBOX_L_INV_32 = make_lut32([](u32 s, u32 shift){
+  return inv_rotate_rows(inv_mix_columns((u32) inv_SBOX[s] << shift));
+});
+// inv_round_no_MC(., 0)
+static constexpr lut32_t LUT_INV_NO_MC_32 = make_lut32([](u32 s, u32 shift){
+  const u8 rotated = (u8) (inv_rotate_rows(s << shift) >> shift);
+  return (u32) inv_SBOX[rotated] << shift;
+});
+// inv_linear_layer(inv_round_no_MC(., 0))
+static constexpr lut32_t LUT_INV_NO_MC_L_INV_32 = make_lut32([](u32 s, u32 shift){
+  const u8 rotated = (u8) (inv_rotate_rows(s << shift) >> shift);
+  return inv_rotate_rows(inv_mix_columns((u32) inv_SBOX[rotated] << shift));
+});
 
-    LUT_L_FROM_MSB[s]  =      (mix_columns(rotate_rows(s << 16)));
-
-    LUT_L_MSB_2[s] =      ((u8) (mix_columns(rotate_rows(s <<  0)) >> 16));
-    LUT_L_MSB_1[s] =      ((u8) (mix_columns(rotate_rows(s <<  8)) >> 16));
-    LUT_L_MSB_0[s] =      ((u8) (mix_columns(rotate_rows(s << 16)) >> 16));
-    LUT_L_MIDDLESB_2[s] = ((u8) (mix_columns(rotate_rows(s <<  0)) >>  8));
-    LUT_L_MIDDLESB_1[s] = ((u8) (mix_columns(rotate_rows(s <<  8)) >>  8));
-    LUT_L_MIDDLESB_0[s] = ((u8) (mix_columns(rotate_rows(s << 16)) >>  8));
-    LUT_L_LSB_2[s] =      ((u8) (mix_columns(rotate_rows(s <<  0)) >>  0));
-    LUT_L_LSB_1[s] =      ((u8) (mix_columns(rotate_rows(s <<  8)) >>  0));
-    LUT_L_LSB_0[s] =      ((u8) (mix_columns(rotate_rows(s << 16)) >>  0));
-  }
+static constexpr u32 inv_linear_layer(u32 s){
+  return lut32_lookup(LUT_L_INV_32, s);
+}
 
+static constexpr u32 linear_layer(u32 s){
+  return lut32_lookup(LUT_L_32, s);
 }
 
+// linear_layer(sub_bytes) and rotate_rows(sub_bytes), i.e., round_with_MC
+// and round_no_MC without the key
+static constexpr lut32_t LUT_ROUND_MC_32 = make_lut32([](u32 s, u32 shift){ return linear_layer((u32) SBOX[s] << shift); });
+static constexpr lut32_t LUT_ROUND_NO_MC_32 = make_lut32([](u32 s, u32 shift){ return rotate_rows((u32) SBOX[s] << shift); });
+
+static_assert(inv_linear_layer(linear_layer(0x7e47ce)) == 0x7e47ce && linear_layer(0x7e47ce) == mix_columns(rotate_rows(0x7e47ce)));
+
+// The rounds are fused like the T-tables of AES: sub_bytes and the linear
+// layer (or rotate_rows) of one round are a single lut32_lookup. An inverse
+// round with MC is not, inv_linear_layer mixes the bytes before
+// inv_sub_bytes, but a chain of them is in the inv_linear_layer domain (see
+// inv_round_with_MC_L_inv). test() checks all of them against the layers.
 u32 inv_round_with_MC(u32 state, u32 round_key){
   state = state ^ round_key;
   state = inv_linear_layer(state);
@@ -257,27 +510,21 @@ u32 inv_round_with_MC_inv_key(u32 state, u32 inv_round_key){
   state = inv_sub_bytes(state);
   return state;
 }
+// inv_linear_layer(inv_round_with_MC(state, round_key)) given
+// v = inv_linear_layer(state) and inv_round_key = inv_linear_layer(round_key)
+u32 inv_round_with_MC_L_inv(u32 v, u32 inv_round_key){
+  return lut32_lookup(LUT_INV_SBOX_L_INV_32, v ^ inv_round_key);
+}
 
 u32 inv_round_no_MC(u32 state, u32 round_key){
-  state = state ^ round_key;
-  state = inv_rotate_rows(state);
-  state = inv_sub_bytes(state);
-  return state;
-  //state = state ^ round_key;
-  //return ((u32) inv_NO_MC_LUT_0[state] << 16) ^ ((u32) inv_NO_MC_LUT_1[state] << 8) ^ ((u32) inv_NO_MC_LUT_2[state]);
+  return lut32_lookup(LUT_INV_NO_MC_32, state ^ round_key);
 }
 
 u32 round_with_MC(u32 state, u32 round_key){
-  state = sub_bytes(state);
-  state = linear_layer(state);
-  state = state ^ round_key;
-  return state;
+  return lut32_lookup(LUT_ROUND_MC_32, state) ^ round_key;
 }
 u32 round_no_MC(u32 state, u32 round_key){
-  state = sub_bytes(state);
-  state = rotate_rows(state);
-  state = state ^ round_key;
-  return state;
+  return lut32_lookup(LUT_ROUND_NO_MC_32, state) ^ round_key;
 }
 
 u32 g(u32 key_word, u32 rc){
@@ -312,6 +559,25 @@ u32* key_schedule(u32 rk[11], u128 master_key, u64 seed){
   return rk;
 }
 
+// invert the key schedule (seed 0): the round keys 6 to 10 are taken from
+// the updated key state K' = (W0', W1', W2', W3') with
+// W0' = W0 ^ g(W3, 1), W1' = W1 ^ W0', W2' = W2 ^ W1', W3' = W3 ^ W2'
+// rk6 = K'[111:88], rk7 = K'[87:64], rk8 = K'[63:40], rk9 = K'[39:16] and
+// rk10 = K'[15:0] || (K'[127:120] ^ SBOX[K'[23:16]] ^ 2)
+// -> the master key is determined by rk6, ..., rk10 and k = K'[119:112]
+u128 master_key_from_round_keys(u32 rk6, u32 rk7, u32 rk8, u32 rk9, u32 rk10, u8 k){
+  u32 W3_ = ((rk9 & 0xFFFF) << 16) ^ (rk10 >> 8);
+  u32 W2_ = (rk8 << 8) ^ (rk9 >> 16);
+  u32 W1_ = ((rk6 & 0xFF) << 24) ^ rk7;
+  u8 K_127_120 = (rk10 & 0xFF) ^ SBOX[(W3_ >> 16) & 0xFF] ^ 2;
+  u32 W0_ = ((u32) K_127_120 << 24) ^ ((u32) k << 16) ^ (rk6 >> 8);
+  u32 W3 = W3_ ^ W2_;
+  u32 W2 = W2_ ^ W1_;
+  u32 W1 = W1_ ^ W0_;
+  u32 W0 = W0_ ^ g(W3, 1);
+  return ((u128) W0 << 96) ^ ((u128) W1 << 64) ^ ((u128) W2 << 32) ^ (u128) W3;
+}
+
 u32 encrypt(u32 state, u128 master_key, u64 seed){
   u32 rk[11] = {0};
   key_schedule(rk, master_key, seed);
@@ -328,9 +594,13 @@ u32 decrypt(u32 state, u128 master_key, u64 seed){
   u32 rk[11] = {0};
   key_schedule(rk, master_key, seed);
   state = inv_round_no_MC(state, rk[10]);
-  for(int i = 9; i > 0; i--){
-    state = inv_round_with_MC(state, rk[i]);
+  // the rounds with MC on v = inv_linear_layer(state), the keys do not
+  // depend on the state and are off the critical path
+  u32 v = inv_linear_layer(state);
+  for(int i = 9; i > 1; i--){
+    v = inv_round_with_MC_L_inv(v, inv_linear_layer(rk[i]));
   }
+  state = inv_sub_bytes(v ^ inv_linear_layer(rk[1]));
   state = state ^ rk[0];
   return state;
 }
@@ -370,607 +640,4357 @@ void test(){
 
   if (decrypt(cipher, key, seed) == plain) std::cout << "Decrypt: OK!" << std::endl;
   else std::cout << "Decrypt: BAD!" << std::endl;
+
+  // fused rounds against the layers for 2**16 pseudo-random states and round
+  // keys (every table entry is hit many times)
+  bool fused_ok = true;
+  for(u32 i = 0; i < (1 << 16); i++){
+    const u32 x = (i * 0x9e3779b9) >> 8, k = (i * 0x85ebca6b) >> 8;
+    fused_ok &= round_with_MC(x, k) == (linear_layer(sub_bytes(x)) ^ k);
+    fused_ok &= round_no_MC(x, k) == (rotate_rows(sub_bytes(x)) ^ k);
+    fused_ok &= inv_round_no_MC(x, k) == inv_sub_bytes(inv_rotate_rows(x ^ k));
+    fused_ok &= inv_round_with_MC_L_inv(inv_linear_layer(x), inv_linear_layer(k)) == inv_linear_layer(inv_round_with_MC(x, k));
+  }
+  if (fused_ok) std::cout << "Fused round tables: OK!" << std::endl;
+  else std::cout << "Fused round tables: BAD!" << std::endl;
+
+  u32 rk[11] = {0};
+  key_schedule(rk, key, 0);
+  if (master_key_from_round_keys(rk[6], rk[7], rk[8], rk[9], rk[10], rk[5] & 0xFF) == key) std::cout << "Inverse key_schedule: OK!" << std::endl;
+  else std::cout << "Inverse key_schedule: BAD!" << std::endl;
 }
 /////////////////////////////////////////
 // END OF HALFLOOP-24 IMPLEMENTATION   //
 /////////////////////////////////////////
 
-
 /////////////////////////////////////////
-// START OF AFFINE SUBSPACE STUFF      //
+// START OF BITSLICED HALFLOOP-24      //
 /////////////////////////////////////////
-typedef __m256i subset_t;
+// Batch encryption/decryption of BS_LANES independent (state, master key, seed)
+// triples. Bit i of all lanes is stored in one vector V (__m256i: 256 lanes,
+// __m512i: 512 lanes, GCC provides ^, & and ~ for both). The S-box is the
+// circuit of Boyar and Peralta (113 gates), mix_columns and inv_mix_columns are
+// XOR networks of the equations above and rotate_rows only renames bits.
+#ifdef __AVX512F__
+typedef __m512i bs_vec_t;
+#else
+typedef __m256i bs_vec_t;
+#endif
+const int BS_LANES = 8 * sizeof(bs_vec_t);
 
-void subset_print(auto name, const subset_t &var) {
-  std::cout << name << ": 0b";
-  u64 element = _mm256_extract_epi64(var, 3);
-  for (int j = 63; j >= 0; j--) {
-    u32 bit = (element >> j) & 1;
-    std::cout << bit;
-  }
-  std::cout << " ";
-  element = _mm256_extract_epi64(var, 2);
-  for (int j = 63; j >= 0; j--) {
-    u32 bit = (element >> j) & 1;
-    std::cout << bit;
-  }
-  std::cout << " ";
-  element = _mm256_extract_epi64(var, 1);
-  for (int j = 63; j >= 0; j--) {
-    u32 bit = (element >> j) & 1;
-    std::cout << bit;
-  }
-  std::cout << " ";
-  element = _mm256_extract_epi64(var, 0);
-  for (int j = 63; j >= 0; j--) {
-    u32 bit = (element >> j) & 1;
-    std::cout << bit;
-  }
-  std::cout << std::endl;
+// x[i] = bit i of a byte
+template<typename V> inline void bs_sub_byte(V *x){
+  const V T1 = x[7] ^ x[4];
+  const V T2 = x[7] ^ x[2];
+  const V T3 = x[7] ^ x[1];
+  const V T4 = x[4] ^ x[2];
+  const V T5 = x[3] ^ x[1];
+  const V T6 = T1 ^ T5;
+  const V T7 = x[6] ^ x[5];
+  const V T8 = x[0] ^ T6;
+  const V T9 = x[0] ^ T7;
+  const V T10 = T6 ^ T7;
+  const V T11 = x[6] ^ x[2];
+  const V T12 = x[5] ^ x[2];
+  const V T13 = T3 ^ T4;
+  const V T14 = T6 ^ T11;
+  const V T15 = T5 ^ T11;
+  const V T16 = T5 ^ T12;
+  const V T17 = T9 ^ T16;
+  const V T18 = x[4] ^ x[0];
+  const V T19 = T7 ^ T18;
+  const V T20 = T1 ^ T19;
+  const V T21 = x[1] ^ x[0];
+  const V T22 = T7 ^ T21;
+  const V T23 = T2 ^ T22;
+  const V T24 = T2 ^ T10;
+  const V T25 = T20 ^ T17;
+  const V T26 = T3 ^ T16;
+  const V T27 = T1 ^ T12;
+  const V M1 = T13 & T6;
+  const V M2 = T23 & T8;
+  const V M3 = T14 ^ M1;
+  const V M4 = T19 & x[0];
+  const V M5 = M4 ^ M1;
+  const V M6 = T3 & T16;
+  const V M7 = T22 & T9;
+  const V M8 = T26 ^ M6;
+  const V M9 = T20 & T17;
+  const V M10 = M9 ^ M6;
+  const V M11 = T1 & T15;
+  const V M12 = T4 & T27;
+  const V M13 = M12 ^ M11;
+  const V M14 = T2 & T10;
+  const V M15 = M14 ^ M11;
+  const V M16 = M3 ^ M2;
+  const V M17 = M5 ^ T24;
+  const V M18 = M8 ^ M7;
+  const V M19 = M10 ^ M15;
+  const V M20 = M16 ^ M13;
+  const V M21 = M17 ^ M15;
+  const V M22 = M18 ^ M13;
+  const V M23 = M19 ^ T25;
+  const V M24 = M22 ^ M23;
+  const V M25 = M22 & M20;
+  const V M26 = M21 ^ M25;
+  const V M27 = M20 ^ M21;
+  const V M28 = M23 ^ M25;
+  const V M29 = M28 & M27;
+  const V M30 = M26 & M24;
+  const V M31 = M20 & M23;
+  const V M32 = M27 & M31;
+  const V M33 = M27 ^ M25;
+  const V M34 = M21 & M22;
+  const V M35 = M24 & M34;
+  const V M36 = M24 ^ M25;
+  const V M37 = M21 ^ M29;
+  const V M38 = M32 ^ M33;
+  const V M39 = M23 ^ M30;
+  const V M40 = M35 ^ M36;
+  const V M41 = M38 ^ M40;
+  const V M42 = M37 ^ M39;
+  const V M43 = M37 ^ M38;
+  const V M44 = M39 ^ M40;
+  const V M45 = M42 ^ M41;
+  const V M46 = M44 & T6;
+  const V M47 = M40 & T8;
+  const V M48 = M39 & x[0];
+  const V M49 = M43 & T16;
+  const V M50 = M38 & T9;
+  const V M51 = M37 & T17;
+  const V M52 = M42 & T15;
+  const V M53 = M45 & T27;
+  const V M54 = M41 & T10;
+  const V M55 = M44 & T13;
+  const V M56 = M40 & T23;
+  const V M57 = M39 & T19;
+  const V M58 = M43 & T3;
+  const V M59 = M38 & T22;
+  const V M60 = M37 & T20;
+  const V M61 = M42 & T1;
+  const V M62 = M45 & T4;
+  const V M63 = M41 & T2;
+  const V L0 = M61 ^ M62;
+  const V L1 = M50 ^ M56;
+  const V L2 = M46 ^ M48;
+  const V L3 = M47 ^ M55;
+  const V L4 = M54 ^ M58;
+  const V L5 = M49 ^ M61;
+  const V L6 = M62 ^ L5;
+  const V L7 = M46 ^ L3;
+  const V L8 = M51 ^ M59;
+  const V L9 = M52 ^ M53;
+  const V L10 = M53 ^ L4;
+  const V L11 = M60 ^ L2;
+  const V L12 = M48 ^ M51;
+  const V L13 = M50 ^ L0;
+  const V L14 = M52 ^ M61;
+  const V L15 = M55 ^ L1;
+  const V L16 = M56 ^ L0;
+  const V L17 = M57 ^ L1;
+  const V L18 = M58 ^ L8;
+  const V L19 = M63 ^ L4;
+  const V L20 = L0 ^ L1;
+  const V L21 = L1 ^ L7;
+  const V L22 = L3 ^ L12;
+  const V L23 = L18 ^ L2;
+  const V L24 = L15 ^ L9;
+  const V L25 = L6 ^ L10;
+  const V L26 = L7 ^ L9;
+  const V L27 = L8 ^ L10;
+  const V L28 = L11 ^ L14;
+  const V L29 = L11 ^ L17;
+  x[7] = L6 ^ L24;
+  x[6] = ~(L16 ^ L26);
+  x[5] = ~(L19 ^ L28);
+  x[4] = L6 ^ L21;
+  x[3] = L20 ^ L22;
+  x[2] = L25 ^ L29;
+  x[1] = ~(L13 ^ L27);
+  x[0] = ~(L6 ^ L23);
 }
 
-inline subset_t subset_intersect(const subset_t &a, const subset_t &b){
-  return _mm256_and_si256(a, b);
+// inverse of x -> M * x^-1 ^ 0x63 via S^-1(y) = M^-1 * S(M^-1 * (y ^ 0x63) ^ 0x63) ^ 0x63)
+// with M^-1 * 0x63 = 0x05 and (M^-1 * y)_i = y_{i+2} ^ y_{i+5} ^ y_{i+7}
+template<typename V> inline void bs_inv_affine(V *x){
+  V y[8];
+  for(int i = 0; i < 8; i++) y[i] = x[(i + 2) % 8] ^ x[(i + 5) % 8] ^ x[(i + 7) % 8];
+  x[0] = ~y[0];
+  x[1] = y[1];
+  x[2] = ~y[2];
+  for(int i = 3; i < 8; i++) x[i] = y[i];
 }
 
-inline subset_t subset_union(const subset_t &a, const subset_t &b){
-  return _mm256_or_si256(a, b);
+template<typename V> inline void bs_inv_sub_byte(V *x){
+  bs_inv_affine(x);
+  bs_sub_byte(x);
+  bs_inv_affine(x);
 }
 
-inline u16 subset_size(const subset_t &a){
-  u16 count = 0;
-  u64 chunk = _mm256_extract_epi64(a, 0);
-  count += __builtin_popcountll(chunk);
-  chunk = _mm256_extract_epi64(a, 1);
-  count += __builtin_popcountll(chunk);
-  chunk = _mm256_extract_epi64(a, 2);
-  count += __builtin_popcountll(chunk);
-  chunk = _mm256_extract_epi64(a, 3);
-  count += __builtin_popcountll(chunk);
-  return count;
+template<typename V> inline void bs_sub_bytes(V *s){
+  bs_sub_byte(s + 0);
+  bs_sub_byte(s + 8);
+  bs_sub_byte(s + 16);
 }
 
-inline bool subset_is_empty(const subset_t &a){
-  return _mm256_testz_si256(a, a);
+template<typename V> inline void bs_inv_sub_bytes(V *s){
+  bs_inv_sub_byte(s + 0);
+  bs_inv_sub_byte(s + 8);
+  bs_inv_sub_byte(s + 16);
 }
 
-subset_t subset_add_element(const subset_t &a, const u8 elm){
-  // compute union of a and {elm}
-  u64 mask[4] = {0};
-  mask[elm/64] = (u64) 1 << (elm % 64);
-  __m256i _mask = _mm256_set_epi64x(mask[3], mask[2], mask[1], mask[0]);
-  return _mm256_or_si256(a, _mask);
-}
-
-subset_t subset_shift(const subset_t &b, const u8 shift){
-  auto a = b;
-  // compute a \oplus shift
-  if((shift >> 7) & 0x1){
-    a = _mm256_permute2x128_si256(a, a, 1);
-  }
-  if((shift >> 6) & 0x1){
-    a = _mm256_permute4x64_epi64(a, _MM_SHUFFLE(2, 3, 0, 1));
-  }
-  if((shift >> 5) & 0x1){
-    a = _mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1));
-  }
-  if((shift >> 4) & 0x1){
-    a = _mm256_shufflelo_epi16(a, _MM_SHUFFLE(2, 3, 0, 1));
-    a = _mm256_shufflehi_epi16(a, _MM_SHUFFLE(2, 3, 0, 1));
-  }
-  if((shift >> 3) & 0x1){
-    const __m256i mask = _mm256_set_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1, 14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
-    a = _mm256_shuffle_epi8(a, mask);
-  }
-  if((shift >> 2) & 0x1){
-    const __m256i maskHigh = _mm256_set1_epi8((char) 0xF0);
-    const __m256i maskLow = _mm256_set1_epi8(0x0F);
-    const __m256i high = _mm256_and_si256(a, maskHigh);
-    const __m256i low = _mm256_and_si256(a, maskLow);
-    a = _mm256_or_si256(_mm256_srli_epi16(high, 4), _mm256_slli_epi16(low, 4));
-  }
-  if((shift >> 1) & 0x1){
-    const __m256i maskHigh = _mm256_set1_epi8((char) 0xCC);
-    const __m256i maskLow = _mm256_set1_epi8(0x33);
-    const __m256i high = _mm256_and_si256(a, maskHigh);
-    const __m256i low = _mm256_and_si256(a, maskLow);
-    a = _mm256_or_si256(_mm256_srli_epi16(high, 2), _mm256_slli_epi16(low, 2));
-  }
-  if((shift >> 0) & 0x1){
-    const __m256i maskHigh = _mm256_set1_epi8((char) 0xAA);
-    const __m256i maskLow = _mm256_set1_epi8(0x55);
-    const __m256i high = _mm256_and_si256(a, maskHigh);
-    const __m256i low = _mm256_and_si256(a, maskLow);
-    a = _mm256_or_si256(_mm256_srli_epi16(high, 1), _mm256_slli_epi16(low, 1));
+// byte 1 (bits 8 to 15) rotated by 6, byte 2 (bits 0 to 7) by 4
+template<typename V> inline void bs_rotate_rows(V *s){
+  V o[16];
+  for(int i = 0; i < 8; i++){
+    o[8 + i] = s[8 + (i + 2) % 8];
+    o[i] = s[(i + 4) % 8];
   }
-  return a;
+  for(int i = 0; i < 16; i++) s[i] = o[i];
 }
 
-std::vector<u8> subset_get_elements(const subset_t &a){
-  std::vector<u8> e;
-  u64 chunk = _mm256_extract_epi64(a, 0);
-  while(chunk != 0){
-    u8 idx = __builtin_ctzll(chunk) + 0*64;
-    e.push_back(idx);
-    chunk &= (chunk - 1);
-  }
-  chunk = _mm256_extract_epi64(a, 1);
-  while(chunk != 0){
-    u8 idx = __builtin_ctzll(chunk) + 1*64;
-    e.push_back(idx);
-    chunk &= (chunk - 1);
+template<typename V> inline void bs_inv_rotate_rows(V *s){
+  V o[16];
+  for(int i = 0; i < 8; i++){
+    o[8 + i] = s[8 + (i + 6) % 8];
+    o[i] = s[(i + 4) % 8];
   }
-  chunk = _mm256_extract_epi64(a, 2);
-  while(chunk != 0){
-    u8 idx = __builtin_ctzll(chunk) + 2*64;
-    e.push_back(idx);
-    chunk &= (chunk - 1);
-  }
-  chunk = _mm256_extract_epi64(a, 3);
-  while(chunk != 0){
-    u8 idx = __builtin_ctzll(chunk) + 3*64;
-    e.push_back(idx);
-    chunk &= (chunk - 1);
-  }
-  return e;
+  for(int i = 0; i < 16; i++) s[i] = o[i];
 }
 
-inline subset_t subset_init_empty(){
-  return _mm256_setzero_si256();
+template<typename V> inline void bs_mix_columns(V *s){
+  V o[24];
+  o[0] = s[0] ^ s[5] ^ s[15] ^ s[16];
+  o[1] = s[1] ^ s[5] ^ s[6] ^ s[8] ^ s[15] ^ s[17];
+  o[2] = s[2] ^ s[6] ^ s[7] ^ s[9] ^ s[18];
+  o[3] = s[0] ^ s[3] ^ s[5] ^ s[7] ^ s[10] ^ s[15] ^ s[19];
+  o[4] = s[1] ^ s[4] ^ s[5] ^ s[6] ^ s[11] ^ s[15] ^ s[20];
+  o[5] = s[2] ^ s[5] ^ s[6] ^ s[7] ^ s[12] ^ s[21];
+  o[6] = s[3] ^ s[6] ^ s[7] ^ s[13] ^ s[22];
+  o[7] = s[4] ^ s[7] ^ s[14] ^ s[23];
+  o[8] = s[0] ^ s[8] ^ s[13] ^ s[23];
+  o[9] = s[1] ^ s[9] ^ s[13] ^ s[14] ^ s[16] ^ s[23];
+  o[10] = s[2] ^ s[10] ^ s[14] ^ s[15] ^ s[17];
+  o[11] = s[3] ^ s[8] ^ s[11] ^ s[13] ^ s[15] ^ s[18] ^ s[23];
+  o[12] = s[4] ^ s[9] ^ s[12] ^ s[13] ^ s[14] ^ s[19] ^ s[23];
+  o[13] = s[5] ^ s[10] ^ s[13] ^ s[14] ^ s[15] ^ s[20];
+  o[14] = s[6] ^ s[11] ^ s[14] ^ s[15] ^ s[21];
+  o[15] = s[7] ^ s[12] ^ s[15] ^ s[22];
+  o[16] = s[7] ^ s[8] ^ s[16] ^ s[21];
+  o[17] = s[0] ^ s[7] ^ s[9] ^ s[17] ^ s[21] ^ s[22];
+  o[18] = s[1] ^ s[10] ^ s[18] ^ s[22] ^ s[23];
+  o[19] = s[2] ^ s[7] ^ s[11] ^ s[16] ^ s[19] ^ s[21] ^ s[23];
+  o[20] = s[3] ^ s[7] ^ s[12] ^ s[17] ^ s[20] ^ s[21] ^ s[22];
+  o[21] = s[4] ^ s[13] ^ s[18] ^ s[21] ^ s[22] ^ s[23];
+  o[22] = s[5] ^ s[14] ^ s[19] ^ s[22] ^ s[23];
+  o[23] = s[6] ^ s[15] ^ s[20] ^ s[23];
+  for(int i = 0; i < 24; i++) s[i] = o[i];
 }
 
-inline subset_t subset_init_full(){
-  return _mm256_set_epi64x(0xFFFFFFFFFFFFFFFF, 0xFFFFFFFFFFFFFFFF, 0xFFFFFFFFFFFFFFFF,  0xFFFFFFFFFFFFFFFF);
+template<typename V> inline void bs_inv_mix_columns(V *s){
+  V o[24];
+  o[0] = s[6] ^ s[7] ^ s[8] ^ s[11] ^ s[14] ^ s[21];
+  o[1] = s[0] ^ s[6] ^ s[8] ^ s[9] ^ s[11] ^ s[12] ^ s[14] ^ s[15] ^ s[21] ^ s[22];
+  o[2] = s[0] ^ s[1] ^ s[7] ^ s[8] ^ s[9] ^ s[10] ^ s[12] ^ s[13] ^ s[15] ^ s[22] ^ s[23];
+  o[3] = s[1] ^ s[2] ^ s[6] ^ s[7] ^ s[9] ^ s[10] ^ s[13] ^ s[16] ^ s[21] ^ s[23];
+  o[4] = s[2] ^ s[3] ^ s[6] ^ s[10] ^ s[17] ^ s[21] ^ s[22];
+  o[5] = s[3] ^ s[4] ^ s[7] ^ s[8] ^ s[11] ^ s[18] ^ s[22] ^ s[23];
+  o[6] = s[4] ^ s[5] ^ s[9] ^ s[12] ^ s[19] ^ s[23];
+  o[7] = s[5] ^ s[6] ^ s[10] ^ s[13] ^ s[20];
+  o[8] = s[5] ^ s[14] ^ s[15] ^ s[16] ^ s[19] ^ s[22];
+  o[9] = s[5] ^ s[6] ^ s[8] ^ s[14] ^ s[16] ^ s[17] ^ s[19] ^ s[20] ^ s[22] ^ s[23];
+  o[10] = s[6] ^ s[7] ^ s[8] ^ s[9] ^ s[15] ^ s[16] ^ s[17] ^ s[18] ^ s[20] ^ s[21] ^ s[23];
+  o[11] = s[0] ^ s[5] ^ s[7] ^ s[9] ^ s[10] ^ s[14] ^ s[15] ^ s[17] ^ s[18] ^ s[21];
+  o[12] = s[1] ^ s[5] ^ s[6] ^ s[10] ^ s[11] ^ s[14] ^ s[18];
+  o[13] = s[2] ^ s[6] ^ s[7] ^ s[11] ^ s[12] ^ s[15] ^ s[16] ^ s[19];
+  o[14] = s[3] ^ s[7] ^ s[12] ^ s[13] ^ s[17] ^ s[20];
+  o[15] = s[4] ^ s[13] ^ s[14] ^ s[18] ^ s[21];
+  o[16] = s[0] ^ s[3] ^ s[6] ^ s[13] ^ s[22] ^ s[23];
+  o[17] = s[0] ^ s[1] ^ s[3] ^ s[4] ^ s[6] ^ s[7] ^ s[13] ^ s[14] ^ s[16] ^ s[22];
+  o[18] = s[0] ^ s[1] ^ s[2] ^ s[4] ^ s[5] ^ s[7] ^ s[14] ^ s[15] ^ s[16] ^ s[17] ^ s[23];
+  o[19] = s[1] ^ s[2] ^ s[5] ^ s[8] ^ s[13] ^ s[15] ^ s[17] ^ s[18] ^ s[22] ^ s[23];
+  o[20] = s[2] ^ s[9] ^ s[13] ^ s[14] ^ s[18] ^ s[19] ^ s[22];
+  o[21] = s[0] ^ s[3] ^ s[10] ^ s[14] ^ s[15] ^ s[19] ^ s[20] ^ s[23];
+  o[22] = s[1] ^ s[4] ^ s[11] ^ s[15] ^ s[20] ^ s[21];
+  o[23] = s[2] ^ s[5] ^ s[12] ^ s[21] ^ s[22];
+  for(int i = 0; i < 24; i++) s[i] = o[i];
 }
 
-/////////////////////////////////////////
-// END OF AFFINE SUBSPACE STUFF        //
-/////////////////////////////////////////
-
-
-/////////////////////////////////////////
-// START OF NEW ATTACK                 //
-/////////////////////////////////////////
+template<typename V> inline void bs_add_round_key(V *s, const V *rk){
+  for(int i = 0; i < 24; i++) s[i] ^= rk[i];
+}
 
-const  u8 N_PAIRS = 3;
-u32 normalize_round_key(u32 round_key, u64 seed, u8 round){
-  // self inverse
-  switch (round) {
-  case 0: return round_key ^ (seed >> 40);
-  case 1: return round_key ^ ((seed >> 16) & 0xFFFFFF);
-  case 2: return round_key ^ ((seed & 0xFFFF) << 8);
-  case 3: return round_key;
-  case 4: return round_key;
-  case 5: return round_key ^ (seed >> 48);
-  case 6: return round_key ^ (((seed >> 32) & 0xFFFF) << 16) ^ ((seed >> 56) ^ ((seed >> 40) & 0xFF));
-  case 7: return round_key ^ ((seed >> 32) & 0xFFFFFF) ^ (seed & 0xFFFFFF);
-  case 8: return round_key ^ ((seed >> 40) & 0xFFFFFF) ^ ((seed >> 8) & 0xFFFFFF);
-  case 9: return round_key ^ ((seed >> 16) & 0xFFFFFF) ^ ((seed & 0xFF) << 16) ^ (seed >> 48);
-  case 10: return round_key ^ ((((seed >> 32) & 0xFFFF) ^ (seed & 0xFFFF)) << 8) ^ (seed >> 56);
-  default: return 0;
+// k[i] = bit i of master_key ^ (seed << 64)
+template<typename V> void bs_key_schedule(V rk[11][24], V *k){
+  const V ones = ~(k[0] ^ k[0]);
+  for(int i = 0; i < 24; i++){
+    rk[0][i] = k[104 + i];
+    rk[1][i] = k[80 + i];
+    rk[2][i] = k[56 + i];
+    rk[3][i] = k[32 + i];
+    rk[4][i] = k[8 + i];
   }
+  for(int i = 0; i < 8; i++) rk[5][16 + i] = k[i];
+  // g(W3, 1) = S(W3_1) ^ 1 || S(W3_2) || S(W3_3) || S(W3_0)
+  V g[32];
+  for(int i = 0; i < 8; i++){
+    g[24 + i] = k[16 + i];
+    g[16 + i] = k[8 + i];
+    g[8 + i] = k[i];
+    g[i] = k[24 + i];
+  }
+  for(int b = 0; b < 4; b++) bs_sub_byte(g + 8*b);
+  g[24] ^= ones;
+  for(int i = 0; i < 32; i++) k[96 + i] ^= g[i];
+  for(int i = 0; i < 32; i++) k[64 + i] ^= k[96 + i];
+  for(int i = 0; i < 32; i++) k[32 + i] ^= k[64 + i];
+  for(int i = 0; i < 32; i++) k[i] ^= k[32 + i];
+  for(int i = 0; i < 16; i++){
+    rk[5][i] = k[112 + i];
+    rk[10][8 + i] = k[i];
+  }
+  for(int i = 0; i < 24; i++){
+    rk[6][i] = k[88 + i];
+    rk[7][i] = k[64 + i];
+    rk[8][i] = k[40 + i];
+    rk[9][i] = k[16 + i];
+  }
+  // last byte of rk10 = K'[127:120] ^ S(W3'_1) ^ 2
+  for(int i = 0; i < 8; i++) g[i] = k[16 + i];
+  bs_sub_byte(g);
+  g[1] ^= ones;
+  for(int i = 0; i < 8; i++) rk[10][i] = k[120 + i] ^ g[i];
 }
 
-u32 normalize_round_key_10(u32 round_key, u8 last_byte_round_key_9, u64 seed){
-  return round_key ^ ((((seed >> 32) & 0xFFFF) ^ (seed & 0xFFFF)) << 8) ^ (seed >> 56) ^ SBOX[last_byte_round_key_9] ^ SBOX[last_byte_round_key_9 ^ ((seed >> 48) & 0xFF) ^ ((seed >> 16) & 0xFF)];
+template<typename V> void bs_encrypt(V *s, const V rk[11][24]){
+  bs_add_round_key(s, rk[0]);
+  for(int r = 1; r < 10; r++){
+    bs_sub_bytes(s);
+    bs_rotate_rows(s);
+    bs_mix_columns(s);
+    bs_add_round_key(s, rk[r]);
+  }
+  bs_sub_bytes(s);
+  bs_rotate_rows(s);
+  bs_add_round_key(s, rk[10]);
 }
-struct pair_t{
-  u32 p : 24; // plaintext
-  u64 t; // tweak = seed
-  u8 d; // delta
-  u32 c : 24; // ciphertext
-  u32 c_prime : 24; // ciphertext'
-};
-
-void new_attack(){
 
-  // step 0: fix key
-  std::cout << "Step 0: Fix key" << std::endl;
-  int error;
-  u128 key;
-  error = getentropy(&key, 16);
-  if(error) std::cout << "BAD RNG" << std::endl;
-  std::cout << "master key: 0x" << std::hex << (u64) (key >> 64) << (u64) key << std::endl;
-  // ROUND KEYS FOR SHORTCUTS later
-  u32 RK[11] = {0}; key_schedule(RK, key, 0);
-  for(int i = 0; i < 11; i++){
-    std::cout << "RK[" << i << "] = 0x" << std::hex << RK[i] << std::endl;
+template<typename V> void bs_decrypt(V *s, const V rk[11][24]){
+  bs_add_round_key(s, rk[10]);
+  bs_inv_rotate_rows(s);
+  bs_inv_sub_bytes(s);
+  for(int r = 9; r > 0; r--){
+    bs_add_round_key(s, rk[r]);
+    bs_inv_mix_columns(s);
+    bs_inv_rotate_rows(s);
+    bs_inv_sub_bytes(s);
   }
-  std::cout << "L^(-1)(RK[7])_0 = 0x" << std::hex << (inv_linear_layer(RK[7]) >> 16) << std::endl;
-  // ---------------------
-  std::cout << std::endl;
-
-  // step 1: gather data
-  // (in CPA setting)
-  auto start = steady_clock::now();
-  std::cout << "Step 1: Generating data:" << std::endl;
-  pair_t PAIRS[N_PAIRS];
-  for(u8 i = 0; i < N_PAIRS; i++){
-    // pick random plaintext, tweak and (one byte) input difference
-    u64 seed = 0;
-    u32 plain = 0;
-    u8 in_diff = 0;
-    error = getentropy(&seed, 8);
-    error = getentropy(&plain, 3);
-    // generate in_diff s.t. in the end N_PAIRS different in_diff are used
-    u8 new_in_diff;
-    do {
-      error = getentropy(&in_diff, 1);
-      new_in_diff = true;
-      if (in_diff == 0) new_in_diff = false;
-      for(u8 j = 0; j < i; j++){
-        if (in_diff == PAIRS[j].d) new_in_diff = false;
-      }
-    } while (!new_in_diff);
+  bs_add_round_key(s, rk[0]);
+}
 
-    PAIRS[i].p = plain;
-    PAIRS[i].t = seed;
-    PAIRS[i].d = in_diff;
-    PAIRS[i].c = encrypt(plain, key, seed);
-    PAIRS[i].c_prime = encrypt(plain ^ (u32) in_diff, key, seed ^ ((u64) in_diff << 40));
+// transpose the 64x64 bit matrices in the 64-bit lanes of a:
+// bit j of lane w of a[i] <-> bit i of lane w of a[j]
+template<typename U> inline void bs_transpose64(U *a){
+  u64 m = 0x00000000FFFFFFFF;
+  for(int j = 32; j != 0; j >>= 1, m ^= m << j){
+    for(int k = 0; k < 64; k = ((k | j) + 1) & ~j){
+      U t = ((a[k] >> j) ^ a[k | j]) & m;
+      a[k] ^= t << j;
+      a[k | j] ^= t;
+    }
   }
-  if(error) std::cout << "BAD RNG" << std::endl;
-  auto stop = steady_clock::now();
-  auto duration = duration_cast<seconds>(stop - start);
-  std::cout << "Took " << std::dec << (2*N_PAIRS) << " queries and " << std::dec << duration.count() << "s" << std::endl;
-  std::cout << std::endl;
-
+}
 
-  // step 2: precomputations
-  start = steady_clock::now();
-  std::cout << "Step 2: Precomputations" << std::endl;
+// same size as V but with unsigned 64-bit lanes (for the shifts in bs_transpose64)
+typedef u64 u64x4_t __attribute__((vector_size(32)));
+typedef u64 u64x8_t __attribute__((vector_size(64)));
+template<int BYTES> struct bs_u64_lanes;
+template<> struct bs_u64_lanes<32>{ typedef u64x4_t type; };
+template<> struct bs_u64_lanes<64>{ typedef u64x8_t type; };
 
-  // Build DDT with specific values
-  auto DDTV_out = new std::vector<u8> [256][256];
-  for(u32 x = 0; x < 256; x++){
-    for(u32 din = 0; din < 256; din++){
-      u32 dout = SBOX[x] ^ SBOX[x ^ din];
-      DDTV_out[din][dout].push_back(SBOX[(u8) x]);
-    }
+// slices[i] = bit i of words[0], ..., words[8*sizeof(V) - 1] for i < n_bits
+// (words 64*w to 64*w + 63 are transposed in lane w)
+template<typename V> void bs_pack(V *slices, const u64 *words, int n_bits){
+  const int W = sizeof(V) / 8;
+  typename bs_u64_lanes<sizeof(V)>::type a[64];
+  u64 lanes[W];
+  for(int i = 0; i < 64; i++){
+    for(int w = 0; w < W; w++) lanes[w] = words[64*w + i];
+    memcpy(&a[i], lanes, sizeof(V));
   }
+  bs_transpose64(a);
+  for(int i = 0; i < n_bits; i++) memcpy(&slices[i], &a[i], sizeof(V));
+}
 
-  auto DDTV_out_shifted = new subset_t [256][256][256];
-  for(unsigned int x = 0; x < 0x100; x++){
-    for(unsigned int y = 0; y < 0x100; y++){
-      for(unsigned int c = 0; c < 0x100; c++){
-        DDTV_out_shifted[x][y][c] = subset_init_empty();
-        for(u8 elm : DDTV_out[x][y]){
-          DDTV_out_shifted[x][y][c] = subset_add_element(DDTV_out_shifted[x][y][c], elm ^ c);
-        }
-      }
-    }
+template<typename V> void bs_unpack(u64 *words, const V *slices, int n_bits){
+  const int W = sizeof(V) / 8;
+  typename bs_u64_lanes<sizeof(V)>::type a[64];
+  u64 lanes[W];
+  memset(a, 0, sizeof(a));
+  for(int i = 0; i < n_bits; i++) memcpy(&a[i], &slices[i], sizeof(V));
+  bs_transpose64(a);
+  for(int i = 0; i < 64; i++){
+    memcpy(lanes, &a[i], sizeof(V));
+    for(int w = 0; w < W; w++) words[64*w + i] = lanes[w];
   }
+}
 
-  // precompute y for which delta_x -S-> delat_y is possible
-  std::vector<u8> *POSSIBLE_DELTA_Y = new std::vector<u8> [256];
-  for(unsigned int x = 0; x < 0x100; x++){
-    for(unsigned int y = 0; y < 0x100; y++){
-      if(!DDTV_out[x][y].empty()){
-        POSSIBLE_DELTA_Y[x].push_back(y);
-      }
-    }
+// en-/decrypt 8*sizeof(V) lanes in place
+template<typename V, bool DECRYPT> void bs_crypt(u32 *state, const u128 *master_key, const u64 *seed){
+  const int LANES = 8 * sizeof(V);
+  u64 words[LANES];
+  V k[128], s[24], rk[11][24];
+  for(int l = 0; l < LANES; l++) words[l] = (u64) master_key[l];
+  bs_pack(k, words, 64);
+  for(int l = 0; l < LANES; l++) words[l] = (u64) (master_key[l] >> 64) ^ seed[l];
+  bs_pack(k + 64, words, 64);
+  bs_key_schedule(rk, k);
+  for(int l = 0; l < LANES; l++) words[l] = state[l];
+  bs_pack(s, words, 24);
+  if(DECRYPT) bs_decrypt(s, rk);
+  else bs_encrypt(s, rk);
+  bs_unpack(words, s, 24);
+  for(int l = 0; l < LANES; l++) state[l] = (u32) words[l];
+}
+
+// en-/decrypt n states in place, state[l] with master_key[l] and seed[l]
+template<bool DECRYPT> void crypt_batch(u32 *state, const u128 *master_key, const u64 *seed, u64 n){
+  u64 l = 0;
+  for(; l + BS_LANES <= n; l += BS_LANES){
+    bs_crypt<bs_vec_t, DECRYPT>(state + l, master_key + l, seed + l);
   }
-  auto T = new subset_t [N_PAIRS][1 << 24][3];
-  for(int i = 0; i < N_PAIRS; i++){
-    for(u32 delta_z7 = 0; delta_z7 < (1 << 24); delta_z7++){
-      for(int j = 0; j < 3; j++){
-        T[i][delta_z7][j] = subset_init_empty();
-      }
-    }
+  if(l < n){
+    // pad the last batch
+    u32 s[BS_LANES] = {0};
+    u128 k[BS_LANES] = {0};
+    u64 t[BS_LANES] = {0};
+    memcpy(s, state + l, (n - l) * sizeof(u32));
+    memcpy(k, master_key + l, (n - l) * sizeof(u128));
+    memcpy(t, seed + l, (n - l) * sizeof(u64));
+    bs_crypt<bs_vec_t, DECRYPT>(s, k, t);
+    memcpy(state + l, s, (n - l) * sizeof(u32));
   }
-  for(int i = 0; i < N_PAIRS; i++){
-    u8 din = PAIRS[i].d;
-    for(u8 dout : POSSIBLE_DELTA_Y[din]){
+}
 
-      u32 delta_x7 = LUT_L_FROM_MSB[dout] ^ ((u32) din << 8);
-      u8 delta_x7_2 = (u8) delta_x7;
-      u8 delta_x7_1 = (u8) (delta_x7 >> 8);
-      u8 delta_x7_0 = (u8) (delta_x7 >> 16);
+void encrypt_batch(u32 *state, const u128 *master_key, const u64 *seed, u64 n){
+  crypt_batch<false>(state, master_key, seed, n);
+}
 
-      for(u8 delta_y7_0 : POSSIBLE_DELTA_Y[delta_x7_0]){
-        for(u8 delta_y7_1 : POSSIBLE_DELTA_Y[delta_x7_1]){
-          for(u8 delta_y7_2 : POSSIBLE_DELTA_Y[delta_x7_2]){
-            u32 delta_y7 = ((u32) delta_y7_0 << 16) ^ ((u32) delta_y7_1 << 8) ^ (u32) delta_y7_2;
-            u32 delta_z7 = linear_layer(delta_y7);
-            T[i][delta_z7][0] = subset_union(T[i][delta_z7][0], DDTV_out_shifted[delta_x7_0][delta_y7_0][0]);
-            T[i][delta_z7][1] = subset_union(T[i][delta_z7][1], DDTV_out_shifted[delta_x7_1][delta_y7_1][0]);
-            T[i][delta_z7][2] = subset_union(T[i][delta_z7][2], DDTV_out_shifted[delta_x7_2][delta_y7_2][0]);
-          }
-        }
-      }
+void decrypt_batch(u32 *state, const u128 *master_key, const u64 *seed, u64 n){
+  crypt_batch<true>(state, master_key, seed, n);
+}
+
+void test_bitsliced(){
+  // S-box on all inputs
+  u8 x[256], y[256];
+  bs_vec_t bits[8];
+  for(int i = 0; i < 256; i++) x[i] = i;
+  for(int b = 0; b < 8; b++){
+    u64 packed[BS_LANES / 64] = {0};
+    for(int i = 0; i < 256; i++) packed[i / 64] |= (u64) ((x[i] >> b) & 1) << (i % 64);
+    memcpy(&bits[b], packed, sizeof(bs_vec_t));
+  }
+  bs_vec_t inv_bits[8];
+  memcpy(inv_bits, bits, sizeof(bits));
+  bs_sub_byte(bits);
+  bs_inv_sub_byte(inv_bits);
+  bool sbox_ok = true, inv_sbox_ok = true;
+  for(int i = 0; i < 256; i++){
+    u64 packed[BS_LANES / 64], inv_packed[BS_LANES / 64];
+    y[i] = 0;
+    u8 z = 0;
+    for(int b = 0; b < 8; b++){
+      memcpy(packed, &bits[b], sizeof(bs_vec_t));
+      memcpy(inv_packed, &inv_bits[b], sizeof(bs_vec_t));
+      y[i] |= ((packed[i / 64] >> (i % 64)) & 1) << b;
+      z |= ((inv_packed[i / 64] >> (i % 64)) & 1) << b;
     }
+    if(y[i] != SBOX[i]) sbox_ok = false;
+    if(z != inv_SBOX[i]) inv_sbox_ok = false;
   }
-  delete(DDTV_out);
-  delete[](POSSIBLE_DELTA_Y);
-  stop = steady_clock::now();
-  duration = duration_cast<seconds>(stop - start);
-  std::cout << "Took " << std::dec << duration.count() << "s" << std::endl;
-  std::cout << std::endl;
-
-  // step 3
-  // enumerate (rk9, rk10) to find candidates ((L^-1 rk7)_0, rk8, rk9, rk10)
-  start = steady_clock::now();
-  std::cout << "Step 3: Identify key candidates" << std::endl;
-
-  std::cout << "Checking " << MAX_RK10 * MAX_RK9 << " of 2**48 candidates for (rk9, rk10)." << std::endl;
-  std::cout << "Using " << (u32) N_PAIRS << " pairs." << std::endl;
-
-  // precompute normalization terms
-  u32 norm_8_[N_PAIRS];
-  u8 norm_8[3][N_PAIRS];
-  for(int i = 0; i < N_PAIRS; i++){
-    norm_8_[i] = inv_linear_layer(normalize_round_key(0, PAIRS[i].t, 8));
-    norm_8[0][i] = (u8) (norm_8_[i] >> 16);
-    norm_8[1][i] = (u8) (norm_8_[i] >> 8);
-    norm_8[2][i] = (u8) norm_8_[i];
-  }
-
-  #if PARALLEL == 1
-  std::cout << "omp_get_num_procs():   " << omp_get_num_procs() << std::endl;
-  std::cout << "omp_get_max_threads(): " << omp_get_max_threads() << std::endl;
-  #endif
-
-  #if CHECK_CORRECT_FIRST == 1
-  bool flag = true;
-  #endif
-
-  #if COUNTERS
-  u64 CNT_rk8[3] = {0};
-  u64 CNT_survives_rk8 = 0;
-  u64 CNT_survives_Dy6 = 0;
-  u64 CNT_survives_rk7 = 0;
-  #endif
-
-  #if PARALLEL == 1
-    #if CHECK_CORRECT_FIRST == 1
-      #if COUNTERS == 1
-        #pragma omp parallel for shared(flag) reduction(+:CNT_rk8[:3], CNT_survives_rk8, CNT_survives_Dy6, CNT_survives_rk7)
-      #else
-        #pragma omp parallel for shared(flag)
-      #endif
-    #else
-      #if COUNTERS == 1
-        #pragma omp parallel for reduction(+:CNT_rk8[:3], CNT_survives_rk8, CNT_survives_Dy6, CNT_survives_rk7)
-      #else
-        #pragma omp parallel for
-      #endif
-    #endif
-  #endif
-  for(u32 rk10_ = 0; rk10_ < MAX_RK10; rk10_++){ // normalised keys
-    for(u32 L_inv_rk9_ = 0; L_inv_rk9_ < MAX_RK9; L_inv_rk9_++){
-
-      #if CHECK_CORRECT_FIRST == 1
-      // correct guess instead of zero guess
-      // correct means round keys for tweak PAIRS[0].t
-      if (flag && (omp_get_thread_num() == 0)) {
-        L_inv_rk9_ = inv_linear_layer(normalize_round_key(RK[9], PAIRS[0].t, 9));
-        rk10_ = normalize_round_key_10(RK[10], (u8) linear_layer(L_inv_rk9_), PAIRS[0].t);
-      }
-      #endif
-
-      // de-normalise keys
-      u32 L_inv_rk9[N_PAIRS], rk10[N_PAIRS], rk10_PRIME[N_PAIRS];
-      L_inv_rk9[0] = L_inv_rk9_;
-      rk10[0] = rk10_;
-      rk10_PRIME[0] = rk10[0] ^ ((u32) PAIRS[0].d << 16);
-      for(int i = 1; i < N_PAIRS; i++){
-        L_inv_rk9[i] = L_inv_rk9[0] ^ inv_linear_layer(normalize_round_key(0, PAIRS[0].t ^ PAIRS[i].t, 9));
-        rk10[i] = normalize_round_key_10(normalize_round_key_10(rk10[0], (u8) linear_layer(L_inv_rk9[0]), PAIRS[0].t), (u8) linear_layer(L_inv_rk9[i]), PAIRS[i].t);
-        rk10_PRIME[i] = rk10[i] ^ ((u32) PAIRS[i].d << 16);
-      }
-
-      // compute Delta_y7 from c, c', rk9, rk10
-      u32 x8[N_PAIRS], x8_PRIME[N_PAIRS], delta_z7[N_PAIRS], v8_[N_PAIRS];
-      u8 v8[3][N_PAIRS];
-      subset_t *bytes_pair[N_PAIRS];
-      for(int i = 0; i < N_PAIRS; i++){
-
-        x8[i] = inv_round_with_MC_inv_key(inv_round_no_MC(PAIRS[i].c, rk10[i]), L_inv_rk9[i]);
-        x8_PRIME[i] = inv_round_with_MC_inv_key(inv_round_no_MC(PAIRS[i].c_prime, rk10_PRIME[i]), L_inv_rk9[i]);
-
-        delta_z7[i] = x8[i] ^ x8_PRIME[i] ^ ((u32) PAIRS[i].d);
-
-        bytes_pair[i] = T[i][delta_z7[i]];
-
-        v8_[i] = inv_linear_layer(x8[i]);
-        v8[0][i] = (u8) (v8_[i] >> 16);
-        v8[1][i] = (u8) (v8_[i] >> 8);
-        v8[2][i] = (u8) v8_[i];
-      }
-
-      #if COUNTERS == 1
-      subset_t intersection[3];
-      for(int j = 0; j < 3; j++){
-        // fast rejection with byte j
-        CNT_rk8[j] += subset_size(bytes_pair[0][j]);
-        intersection[j] = bytes_pair[0][j];
-        for(int i = 1; i < N_PAIRS; i++){
-          CNT_rk8[j] += subset_size(bytes_pair[i][j]);
-          subset_t b = subset_shift(bytes_pair[i][j], v8[j][0] ^ norm_8[j][0] ^ v8[j][i] ^ norm_8[j][i]);
-          intersection[j] = subset_intersect(intersection[j], b);
-        }
-      }
-      for(int j = 0; j < 3; j++) if(subset_is_empty(intersection[j])) goto bad_guess_;
-      CNT_survives_rk8++;
-      #else
-      subset_t intersection[3];
-      for(int j = 0; j < 3; j++){
-        // fast rejection with byte j
-        intersection[j] = bytes_pair[0][j];
-        for(int i = 1; i < N_PAIRS; i++){
-          subset_t b = subset_shift(bytes_pair[i][j], v8[j][0] ^ norm_8[j][0] ^ v8[j][i] ^ norm_8[j][i]);
-          intersection[j] = subset_intersect(intersection[j], b);
-        }
-        if(subset_is_empty(intersection[j])) goto bad_guess_;
-      }
-      #endif
-
-      for(u8 rk8_0 : subset_get_elements(intersection[0])){
-        rk8_0 ^= v8[0][0] ^ norm_8[0][0];
-        for(u8 rk8_1 : subset_get_elements(intersection[1])){
-          rk8_1 ^= v8[1][0] ^ norm_8[1][0];
-          for(u8 rk8_2 : subset_get_elements(intersection[2])){
-            rk8_2 ^= v8[2][0] ^ norm_8[2][0];
-            u32 rk8;
-            rk8 = linear_layer(((u32) rk8_0 << 16) ^ ((u32) rk8_1 << 8) ^ ((u32) rk8_2));
-            subset_t L_inv_rk7_0;
-            L_inv_rk7_0 = subset_init_full();
-            for(int i = 0; i < N_PAIRS; i++){
-              u32 rk8_normalised = normalize_round_key(rk8, PAIRS[i].t, 8);
-              u32 rk8_PRIME_normalised = rk8_normalised ^ ((u32) PAIRS[i].d);
-              u32 v7 = inv_linear_layer(inv_round_with_MC(x8[i], rk8_normalised));
-              u32 v7_PRIME = inv_linear_layer(inv_round_with_MC(x8_PRIME[i], rk8_PRIME_normalised) ^ ((u32) PAIRS[i].d << 8));
-              if(((v7 ^ v7_PRIME) & 0x00FFFF) != 0) goto next_rk_8;
-              #if COUNTERS == 1
-              CNT_survives_Dy6++;
-              #endif
-              u8 delta_v7_0 = (u8) ((v7 ^ v7_PRIME) >> 16);
-              u8 norm_7_0 = (u8) (inv_linear_layer(normalize_round_key(0, PAIRS[i].t, 7)) >> 16);
-              u8 v7_0 = (u8) (v7 >> 16);
-              L_inv_rk7_0 = subset_intersect(L_inv_rk7_0, DDTV_out_shifted[PAIRS[i].d][delta_v7_0][v7_0 ^ norm_7_0]);
-            }
-            for(u8 L_inv_rk7_0_ : subset_get_elements(L_inv_rk7_0)){
-              #if COUNTERS == 1
-              CNT_survives_rk7++;
-              #endif
-              std::cout << "Candidate: L_inv_rk7_0 = 0x" << std::hex << (u32) L_inv_rk7_0_ << ", rk8 = 0x" << rk8;
-              std::cout << ", rk9 = 0x" << normalize_round_key(linear_layer(L_inv_rk9_), PAIRS[0].t, 9);
-              std::cout << ", rk10 = 0x" << normalize_round_key_10(rk10_, (u8) linear_layer(L_inv_rk9_), PAIRS[0].t) << std::endl;
-            }
-          next_rk_8:;
-          }
-        }
-      }
-    bad_guess_:;
+  if (sbox_ok) std::cout << "Bitsliced sub_bytes: OK!" << std::endl;
+  else std::cout << "Bitsliced sub_bytes: BAD!" << std::endl;
+  if (inv_sbox_ok) std::cout << "Bitsliced inverse sub_bytes: OK!" << std::endl;
+  else std::cout << "Bitsliced inverse sub_bytes: BAD!" << std::endl;
 
-      #if CHECK_CORRECT_FIRST == 1
-      // set keys back to zero and flip flag in first iteration
-      if (flag && (omp_get_thread_num() == 0)) {
-        L_inv_rk9_ = 0;
-        rk10_ = 0;
-        flag = false;
-      }
-      #endif
-    }
+  // test vector of test() in lane 0, random (state, key, seed) in the other lanes
+  const u64 n = BS_LANES + 3;
+  std::vector<u32> state(n), state_copy(n);
+  std::vector<u128> key(n);
+  std::vector<u64> seed(n);
+  int error = 0;
+  for(u64 l = 0; l < n; l++){
+    error |= getentropy(&key[l], 16);
+    error |= getentropy(&seed[l], 8);
+    error |= getentropy(&state[l], 3);
   }
-  stop = steady_clock::now();
-  auto duration_ns = duration_cast<nanoseconds>(stop - start);
-  std::cout << "Took      " << std::dec << duration_ns.count() << "ns = " << (MAX_RK10 * MAX_RK9) << " * " << duration_ns.count()/(MAX_RK10 * MAX_RK9) << "ns" << std::endl;
-  #if COUNTERS == 1
-  std::cout << "Notice that the timings are effected by the counting! To benchamrk performance set COUTNERS to 0" << std::endl;
-  std::cout << std::endl;
-  std::cout << "Average number of candidaets for rk^{(8)}_0: " << (double) CNT_rk8[0] / (MAX_RK10 * MAX_RK9) / N_PAIRS << std::endl;
-  std::cout << "Average number of candidaets for rk^{(8)}_1: " << (double) CNT_rk8[1] / (MAX_RK10 * MAX_RK9) / N_PAIRS << std::endl;
-  std::cout << "Average number of candidaets for rk^{(8)}_2: " << (double) CNT_rk8[2] / (MAX_RK10 * MAX_RK9) / N_PAIRS << std::endl;
-  std::cout << "Survived rk8 filter: " << (double) CNT_survives_rk8 / (MAX_RK10 * MAX_RK9) << std::endl;
-  std::cout << "Survived Delta y6 filter: " << (double) CNT_survives_Dy6 / (MAX_RK10 * MAX_RK9) << std::endl;
-  std::cout << "Survived rk7 filter: " << (double) CNT_survives_rk7 / (MAX_RK10 * MAX_RK9) << std::endl;
-  #endif
-  std::cout << std::endl;
+  if(error) std::cout << "BAD RNG" << std::endl;
+  key[0] = ((u128) 0x2b7e151628aed2a6 << 64) ^ 0xabf7158809cf4f3cULL;
+  seed[0] = 0x543bd88000017550;
+  state[0] = 0x010203;
+  state_copy = state;
+  encrypt_batch(state.data(), key.data(), seed.data(), n);
+  bool encrypt_ok = (state[0] == 0xf28c1e);
+  for(u64 l = 0; l < n; l++) if(state[l] != encrypt(state_copy[l], key[l], seed[l])) encrypt_ok = false;
+  if (encrypt_ok) std::cout << "Bitsliced encrypt: OK!" << std::endl;
+  else std::cout << "Bitsliced encrypt: BAD!" << std::endl;
 
-  delete(DDTV_out_shifted);
-  delete(T);
-  // Step4: Brute force remaining key bits: same as in [DDLS22] and therefore omitted
+  decrypt_batch(state.data(), key.data(), seed.data(), n);
+  if (state == state_copy) std::cout << "Bitsliced decrypt: OK!" << std::endl;
+  else std::cout << "Bitsliced decrypt: BAD!" << std::endl;
 }
 /////////////////////////////////////////
-// END OF NEW ATTACK                   //
+// END OF BITSLICED HALFLOOP-24        //
 /////////////////////////////////////////
 
-// this function is used to generate the data for the figure
-// regarding the number of candidates for rk8
-void compute_number_of_rk8_candidates(){
-  // for every non-zero delta and every Delta y_7 compute the number of possible rk8
-  std::cout << "Computing distributions of |RK^{(8)}_j|" << std::endl;
 
-  // compute DDT
-  auto DDT = new u32 [256][256];
-  for(u32 x = 0; x < 256; x++){
-    for(u32 din = 0; din < 256; din++){
-      u32 dout = SBOX[x] ^ SBOX[x ^ din];
-      DDT[din][dout]++;
-    }
-  }
+/////////////////////////////////////////
+// START OF AFFINE SUBSPACE STUFF      //
+/////////////////////////////////////////
+// instruction set of step 3, see STEP3_ISA
+enum isa_t {
+  ISA_BASELINE = 0, // x86-64 (SSE2)
+  ISA_AVX2 = 1,     // AVX2, BMI2
+  ISA_AVX512 = 2,   // AVX-512 with VBMI and VPOPCNTDQ, GFNI
+};
+static const char *ISA_NAMES[] = {"baseline", "avx2", "avx512"};
+const int N_ISAS = 3;
+// what STEP3_ISA applies to (see subset_backend_t)
+#ifdef STEP3_ISA_DISPATCH
+static const char *ISA_SCOPE = "subset operations";
+#else
+static const char *ISA_SCOPE = "instructions";
+#endif
 
-  for(int j = 0; j < 4; j++){
-    std::cout << "Running computation for j = " << std::dec << j << std::endl;
-    auto N_CAND = new u16[256][1 << 24];
-    for(u32 delta = 1; delta < 256; delta++){
-      std::cout << "#" << std::flush;
-      for(u32 gamma = 1; gamma < 256; gamma++){
-        if(DDT[delta][gamma] == 0) continue;
-        u32 delta_x7 = mix_columns(rotate_rows(gamma << 16)) ^ (delta << 8);
-        u8 delta_x7_0 = (u8) (delta_x7 >> 16);
-        u8 delta_x7_1 = (u8) (delta_x7 >> 8);
-        u8 delta_x7_2 = (u8) delta_x7;
-
-        for(u32 delta_y7_0 = 0; delta_y7_0 < 256; delta_y7_0++){
-          if(DDT[delta_x7_0][delta_y7_0] == 0) continue;
-
-          for(u32 delta_y7_1 = 0; delta_y7_1 < 256; delta_y7_1++){
-            if(DDT[delta_x7_1][delta_y7_1] == 0) continue;
-
-            for(u32 delta_y7_2 = 0; delta_y7_2 < 256; delta_y7_2++){
-              if(DDT[delta_x7_2][delta_y7_2] == 0) continue;
-
-              u32 delta_y7 = (delta_y7_0 << 16) ^ (delta_y7_1 << 8) ^ delta_y7_2;
-              if(j == 0) N_CAND[delta][delta_y7] += DDT[delta_x7_0][delta_y7_0];
-              else if(j == 1) N_CAND[delta][delta_y7] += DDT[delta_x7_1][delta_y7_1];
-              else if(j == 2) N_CAND[delta][delta_y7] += DDT[delta_x7_2][delta_y7_2];
-              else if(j == 3) N_CAND[delta][delta_y7] += DDT[delta_x7_0][delta_y7_0]*DDT[delta_x7_1][delta_y7_1]*DDT[delta_x7_2][delta_y7_2];
-            }
-          }
-        }
-      }
-    }
-    std::cout << std::endl << "finished computation" << std::endl;
-    u32 max = 0;
-    double avg = 0;
-    u32 hist[4097] = {0}; // 4097 is max_j so enough for all j
-    u32 cnt_zero = 0;
-    for(u32 delta = 1; delta < 256; delta++){
-      for(u32 delta_y7 = 0; delta_y7 < (1 << 24); delta_y7++){
-        u16 n = N_CAND[delta][delta_y7];
-        if(n > max) max = n;
-        avg += n;
-        hist[n]++;
-        if(n == 0) cnt_zero++;
-      }
-    }
-    avg = avg / ((double) 255 * (1 << 24));
-    std::cout << "MAX: " << std::dec << max << std::endl;
-    std::cout << "Avg: " << std::dec << avg << std::endl;
-    std::cout << "#Zeros: " << std::dec << cnt_zero << std::endl;
+// GCC targets of ISA_AVX2 and ISA_AVX512
+#define ISA_TARGET_AVX2 "avx2,bmi,bmi2,popcnt,fma"
+#define ISA_TARGET_AVX512 ISA_TARGET_AVX2 ",avx512f,avx512vl,avx512bw,avx512vbmi,avx512vpopcntdq,gfni"
 
-    for(int i = 0; i < 4097; i++){
-      if(hist[i] == 0) continue;
-      std::cout << "HIST_" << std::dec << j << "[" << i << "] = " << hist[i] << std::endl;
-    }
-    delete(N_CAND);
-  }
+// best instruction set the CPU supports
+int detect_isa(){
+  __builtin_cpu_init();
+  bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2") &&
+              __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("fma");
+  bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512bw") &&
+                __builtin_cpu_supports("avx512vbmi") && __builtin_cpu_supports("avx512vpopcntdq") && __builtin_cpu_supports("gfni");
+  if(avx2 && avx512) return ISA_AVX512;
+  if(avx2) return ISA_AVX2;
+  return ISA_BASELINE;
 }
 
-int main() {
-  /////////////////
-  generate_tables(); // never remove!
-  test();
-  /////////////////
+// -1 for an unknown name or an instruction set the CPU or this build does not support
+int isa_from_name(const std::string &name){
+#ifdef STEP3_ISA_DISPATCH
+  const int best = detect_isa();
+  if(name == "auto") return best;
+  for(int k = 0; k < N_ISAS; k++) if(name == ISA_NAMES[k]) return k <= best ? k : -1;
+  return -1;
+#else
+  // fixed at compile time
+  if(name != "auto") return -1;
+#ifdef __AVX512F__
+  return ISA_AVX512;
+#else
+  return ISA_AVX2;
+#endif
+#endif
+}
 
-  // generate data for figures in papaer
-  // compute_number_of_rk8_candidates();
-  // return 0;
+// false if the binary was compiled for instructions the CPU does not have
+// (e.g. -march=native on another machine)
+bool cpu_supports_build(){
+  __builtin_cpu_init();
+  bool ok = true;
+#ifdef __AVX2__
+  ok = ok && __builtin_cpu_supports("avx2");
+#endif
+#ifdef __AVX512F__
+  ok = ok && __builtin_cpu_supports("avx512f");
+#endif
+#ifdef __AVX512VBMI__
+  ok = ok && __builtin_cpu_supports("avx512vbmi");
+#endif
+#ifdef __AVX512VPOPCNTDQ__
+  ok = ok && __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+#ifdef __GFNI__
+  ok = ok && __builtin_cpu_supports("gfni");
+#endif
+  return ok;
+}
+
+// A subset of F_2^8 is a 256 bit vector, element i is bit i % 64 of word i / 64.
+// The operations use GCC vector extensions s.t. they compile for any x86-64
+// CPU (GCC picks AVX2 or AVX-512 instructions where the target has them),
+// with -march=native AVX-512 VBMI, GFNI and VPOPCNTDQ are used directly,
+// a portable build picks subset_size and subset_intersect_shift at startup
+// (see subset_backend_t).
+typedef __m256i subset_t;
+typedef u8 subset_bytes_t __attribute__((vector_size(32)));
+typedef u64 subset_words_t __attribute__((vector_size(32)));
+
+void subset_print(auto name, const subset_t &var) {
+  std::cout << name << ": 0b";
+  for (int w = 3; w >= 0; w--) {
+    u64 element = var[w];
+    for (int j = 63; j >= 0; j--) {
+      u32 bit = (element >> j) & 1;
+      std::cout << bit;
+    }
+    std::cout << (w == 0 ? "" : " ");
+  }
+  std::cout << std::endl;
+}
+
+// subset_t is returned in memory without AVX, -Wpsabi warns about that ABI
+// difference at every such call and function although it never matters here
+// (the only calls between targets are the ones of subset_backend_t, which
+// take subset_t by reference), the warnings are off around these calls and
+// at the end of the file (where GCC reports the ones of the functions)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+inline subset_t subset_intersect(const subset_t &a, const subset_t &b){
+  return a & b;
+}
+
+inline subset_t subset_union(const subset_t &a, const subset_t &b){
+  return a | b;
+}
+
+inline bool subset_is_empty(const subset_t &a){
+#ifdef __AVX__
+  return _mm256_testz_si256(a, a);
+#else
+  return ((a[0] | a[1]) | (a[2] | a[3])) == 0;
+#endif
+}
+
+subset_t subset_add_element(const subset_t &a, const u8 elm){
+  // compute union of a and {elm}
+  subset_words_t mask = {0};
+  mask[elm/64] = (u64) 1 << (elm % 64);
+  return a | (subset_t) mask;
+}
+
+// GF2P8AFFINEQB matrix of the bit permutation i -> i ^ t within a byte
+// (row 7 - i of the matrix selects input bit i ^ t for output bit i)
+constexpr u64 gf2p8_bit_xor_matrix(int t){
+  u64 A = 0;
+  for(int i = 0; i < 8; i++) A |= (u64) 1 << (8*(7 - i) + (i ^ t));
+  return A;
+}
+
+const u64 GF2P8_BIT_XOR[8] = {gf2p8_bit_xor_matrix(0), gf2p8_bit_xor_matrix(1), gf2p8_bit_xor_matrix(2), gf2p8_bit_xor_matrix(3),
+                             gf2p8_bit_xor_matrix(4), gf2p8_bit_xor_matrix(5), gf2p8_bit_xor_matrix(6), gf2p8_bit_xor_matrix(7)};
+
+// BYTE_INDEX ^ (shift >> 3) permutes the bytes of a subset for {x ^ shift | x in b}
+const subset_bytes_t SUBSET_BYTE_INDEX = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                          16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31};
+
+// {x ^ shift | x in b} for any target: the bytes are permuted by shift >> 3,
+// then the halves of every group of 2k bits are swapped if bit k of shift is
+// set (without branches as the shift is random), always inlined s.t. it is
+// compiled for the target of its caller
+inline __attribute__((always_inline)) subset_t subset_shift_generic(const subset_t &b, const u8 shift){
+  subset_bytes_t a = __builtin_shuffle((subset_bytes_t) b, SUBSET_BYTE_INDEX ^ (u8) (shift >> 3));
+  subset_bytes_t m;
+  m = subset_bytes_t{0} - (u8) ((shift >> 2) & 1);
+  a = (a & ~m) | ((((a >> 4) & 0x0F) | ((a << 4) & 0xF0)) & m);
+  m = subset_bytes_t{0} - (u8) ((shift >> 1) & 1);
+  a = (a & ~m) | ((((a >> 2) & 0x33) | ((a << 2) & 0xCC)) & m);
+  m = subset_bytes_t{0} - (u8) (shift & 1);
+  a = (a & ~m) | ((((a >> 1) & 0x55) | ((a << 1) & 0xAA)) & m);
+  return (subset_t) a;
+}
+
+inline __attribute__((always_inline)) u16 subset_size_generic(const subset_t &a){
+  return __builtin_popcountll(a[0]) + __builtin_popcountll(a[1]) + __builtin_popcountll(a[2]) + __builtin_popcountll(a[3]);
+}
+
+#ifndef STEP3_ISA_DISPATCH
+inline u16 subset_size(const subset_t &a){
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+  subset_words_t count = (subset_words_t) _mm256_popcnt_epi64(a);
+  return count[0] + count[1] + count[2] + count[3];
+#else
+  return subset_size_generic(a);
+#endif
+}
+
+// {x ^ shift | x in b}: the bytes are permuted by shift >> 3 (a single vpermb
+// with AVX-512 VBMI) and the bits within every byte by shift & 7
+inline subset_t subset_shift(const subset_t &b, const u8 shift){
+#if defined(__GFNI__) && defined(__AVX__)
+  subset_bytes_t a = __builtin_shuffle((subset_bytes_t) b, SUBSET_BYTE_INDEX ^ (u8) (shift >> 3));
+  return _mm256_gf2p8affine_epi64_epi8((subset_t) a, _mm256_set1_epi64x(GF2P8_BIT_XOR[shift & 7]), 0);
+#else
+  return subset_shift_generic(b, shift);
+#endif
+}
+
+// a = a ∩ {x ^ shift | x in b}, returns false if a is empty then
+inline bool subset_intersect_shift(subset_t &a, const subset_t &b, const u8 shift){
+  a = subset_intersect(a, subset_shift(b, shift));
+  return !subset_is_empty(a);
+}
+#else
+// portable build: the subset operations of the step 3 inner loop that gain
+// from AVX2 and AVX-512 are compiled for every isa_t and the ones of STEP3_ISA
+// are called through SUBSET_BACKEND (everything else, step 3 included, is
+// compiled once for the baseline), subset_t only by reference as the ABI of
+// vector arguments depends on the target
+struct subset_backend_t{
+  u16 (*size)(const subset_t &a);
+  bool (*intersect_shift)(subset_t &a, const subset_t &b, u8 shift);
+};
+
+u16 subset_size_baseline(const subset_t &a){
+  return subset_size_generic(a);
+}
+
+bool subset_intersect_shift_baseline(subset_t &a, const subset_t &b, const u8 shift){
+  a &= subset_shift_generic(b, shift);
+  return !subset_is_empty(a);
+}
+
+__attribute__((target(ISA_TARGET_AVX2)))
+u16 subset_size_avx2(const subset_t &a){
+  return subset_size_generic(a);
+}
+
+__attribute__((target(ISA_TARGET_AVX2)))
+bool subset_intersect_shift_avx2(subset_t &a, const subset_t &b, const u8 shift){
+  a &= subset_shift_generic(b, shift);
+  return !_mm256_testz_si256(a, a);
+}
+
+__attribute__((target(ISA_TARGET_AVX512)))
+u16 subset_size_avx512(const subset_t &a){
+  subset_words_t count = (subset_words_t) _mm256_popcnt_epi64(a);
+  return count[0] + count[1] + count[2] + count[3];
+}
+
+// one vpermb for the bytes and one gf2p8affineqb for the bits within every byte
+__attribute__((target(ISA_TARGET_AVX512)))
+bool subset_intersect_shift_avx512(subset_t &a, const subset_t &b, const u8 shift){
+  const subset_bytes_t bytes = __builtin_shuffle((subset_bytes_t) b, SUBSET_BYTE_INDEX ^ (u8) (shift >> 3));
+  a &= _mm256_gf2p8affine_epi64_epi8((subset_t) bytes, _mm256_set1_epi64x(GF2P8_BIT_XOR[shift & 7]), 0);
+  return !_mm256_testz_si256(a, a);
+}
+
+const subset_backend_t SUBSET_BACKENDS[N_ISAS] = {
+  {subset_size_baseline, subset_intersect_shift_baseline},
+  {subset_size_avx2, subset_intersect_shift_avx2},
+  {subset_size_avx512, subset_intersect_shift_avx512},
+};
+subset_backend_t SUBSET_BACKEND = SUBSET_BACKENDS[ISA_BASELINE]; // see subset_backend_init
+
+inline u16 subset_size(const subset_t &a){
+  return SUBSET_BACKEND.size(a);
+}
+
+// a = a ∩ {x ^ shift | x in b}, returns false if a is empty then
+inline bool subset_intersect_shift(subset_t &a, const subset_t &b, const u8 shift){
+  return SUBSET_BACKEND.intersect_shift(a, b, shift);
+}
+
+// {x ^ shift | x in b} (the intersection with the full set)
+inline subset_t subset_shift(const subset_t &b, const u8 shift){
+  subset_t a = ~subset_t{0};
+  SUBSET_BACKEND.intersect_shift(a, b, shift);
+  return a;
+}
+#endif
+
+// picks the subset operations for isa in a portable build, a native build
+// only has the ones of the instruction set it was compiled for
+void subset_backend_init([[maybe_unused]] int isa){
+#ifdef STEP3_ISA_DISPATCH
+  SUBSET_BACKEND = SUBSET_BACKENDS[isa];
+#endif
+}
+
+// elements of a subset in increasing order for range based for loops,
+// found with tzcnt in a copy of the four words (no allocation)
+struct subset_elements_t{
+  u64 w[4];
+
+  struct iterator{
+    const u64 *w;
+    int i;      // current word, 4 at the end
+    u64 chunk;  // elements of word i that are left
+    // move to the next word with elements if chunk is exhausted
+    void skip(){ while(chunk == 0 && ++i < 4) chunk = w[i]; }
+    u8 operator*() const { return 64*i + __builtin_ctzll(chunk); }
+    iterator &operator++(){ chunk &= chunk - 1; skip(); return *this; }
+    bool operator!=(const iterator &o) const { return i != o.i; }
+  };
+
+  iterator begin() const {
+    iterator it = {w, 0, w[0]};
+    it.skip();
+    return it;
+  }
+  iterator end() const { return {w, 4, 0}; }
+};
+
+inline subset_elements_t subset_get_elements(const subset_t &a){
+  return {{(u64) a[0], (u64) a[1], (u64) a[2], (u64) a[3]}};
+}
+
+inline subset_t subset_init_empty(){
+  return subset_t{0};
+}
+
+inline subset_t subset_init_full(){
+  return ~subset_t{0};
+}
+#pragma GCC diagnostic pop
+
+/////////////////////////////////////////
+// END OF AFFINE SUBSPACE STUFF        //
+/////////////////////////////////////////
+
+
+/////////////////////////////////////////
+// START OF ARENA                      //
+/////////////////////////////////////////
+// The big tables (DDTV_out_shifted, T, N_CAND) live in arenas: one anonymous
+// mapping per arena, with HUGE_PAGES on 1 GiB or 2 MiB pages s.t. the random
+// lookups into T do not need a page walk for every access. Memory is bump
+// allocated and only freed with the whole arena.
+const u64 PAGE_2M = (u64) 1 << 21;
+const u64 PAGE_1G = (u64) 1 << 30;
+
+struct arena_t{
+  u8 *base = nullptr;
+  u64 capacity = 0; // length of the mapping
+  u64 used = 0;
+  u64 page_size = 0;
+  bool transparent = false; // 4 KiB pages advised as transparent huge pages
+};
+
+inline u64 round_up(u64 a, u64 b){
+  return (a + b - 1) / b * b;
+}
+
+const char *arena_pages(const arena_t &a){
+  if(a.page_size == PAGE_1G) return "1 GiB pages";
+  if(a.page_size == PAGE_2M) return "2 MiB pages";
+  return a.transparent ? "transparent huge pages" : "4 KiB pages";
+}
+
+// write every page of [p, p + length) once, spread over the threads
+// (first touch, i.e., the page faults happen in parallel)
+void first_touch(void *p, u64 length){
+  #pragma omp parallel for schedule(static) if(CONFIG.parallel)
+  for(u64 offset = 0; offset < length; offset += PAGE_2M) memset((u8 *) p + offset, 0, std::min(PAGE_2M, length - offset));
+}
+
+// map at least capacity bytes, throws std::bad_alloc like new
+// hugetlbfs pages are only available if reserved by the admin, e.g.
+//   echo n > /sys/kernel/mm/hugepages/hugepages-2048kB/nr_hugepages
+// otherwise transparent huge pages are used (if enabled for madvise)
+void arena_init(arena_t &a, u64 capacity){
+  a = arena_t();
+  if(CONFIG.huge_pages){
+    // 1 GiB pages only for big arenas, the rest of the last page is wasted
+    for(u64 page_size : {PAGE_1G, PAGE_2M}){
+      if(page_size == PAGE_1G && capacity < PAGE_1G) continue;
+      u64 length = round_up(capacity, page_size);
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | ((page_size == PAGE_1G ? 30 : 21) << MAP_HUGE_SHIFT);
+      void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if(p == MAP_FAILED) continue;
+      a.base = (u8 *) p;
+      a.capacity = length;
+      a.page_size = page_size;
+      return;
+    }
+  }
+  // 2 MiB aligned s.t. the whole arena can be backed by transparent huge pages
+  u64 length = round_up(capacity, PAGE_2M);
+  void *p = mmap(nullptr, length + PAGE_2M, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(p == MAP_FAILED) throw std::bad_alloc();
+  u8 *base = (u8 *) round_up((u64) p, PAGE_2M);
+  if(base != p) munmap(p, base - (u8 *) p);
+  munmap(base + length, (u8 *) p + PAGE_2M - base);
+  if(CONFIG.huge_pages) a.transparent = madvise(base, length, MADV_HUGEPAGE) == 0;
+  a.base = base;
+  a.capacity = length;
+  a.page_size = 4096;
+}
+
+void arena_free(arena_t &a){
+  if(a.base != nullptr) munmap(a.base, a.capacity);
+  a = arena_t();
+}
+
+// length zero bytes aligned to a cache line, throws std::bad_alloc like new
+void *arena_alloc(arena_t &a, u64 length){
+  u64 offset = round_up(a.used, 64);
+  if(offset + length > a.capacity) throw std::bad_alloc();
+  a.used = offset + length;
+  first_touch(a.base + offset, length);
+  return a.base + offset;
+}
+
+// n zero objects of type X, e.g., arena_new<subset_t[3]>(a, 1 << 24) for T
+template<typename X>
+X *arena_new(arena_t &a, u64 n){
+  return (X *) arena_alloc(a, n * sizeof(X));
+}
+/////////////////////////////////////////
+// END OF ARENA                        //
+/////////////////////////////////////////
+
+
+/////////////////////////////////////////
+// START OF PRECOMPUTATIONS            //
+/////////////////////////////////////////
+// all tables only depend on the S-box and on the one byte input
+// difference d of a pair but not on the key
+
+// rows of u8 values stored back to back (compressed sparse rows),
+// row r is values[begin[r]], ..., values[begin[r + 1] - 1]
+template<u32 ROWS, u32 N>
+struct csr_u8_t{
+  u32 begin[ROWS + 1];
+  u8 values[N];
+  std::span<const u8> row(u32 r) const { return std::span<const u8>(values + begin[r], values + begin[r + 1]); }
+};
+
+// DDTV_out.row((din << 8) | dout) = {S(x) | S(x) ^ S(x ^ din) = dout}
+typedef csr_u8_t<256*256, 256*256> DDTV_out_t;
+// POSSIBLE_DELTA_Y.row(din) = {dout | din -S-> dout is possible}
+typedef csr_u8_t<256, 256*256> possible_delta_y_t;
+
+void build_DDTV_out(DDTV_out_t &DDTV_out){
+  // count the values of every row, then fill the rows
+  memset(DDTV_out.begin, 0, sizeof(DDTV_out.begin));
+  for(u32 x = 0; x < 256; x++){
+    for(u32 din = 0; din < 256; din++){
+      u32 dout = SBOX[x] ^ SBOX[x ^ din];
+      DDTV_out.begin[((din << 8) | dout) + 1]++;
+    }
+  }
+  for(u32 r = 0; r < 256*256; r++) DDTV_out.begin[r + 1] += DDTV_out.begin[r];
+  std::vector<u32> next(DDTV_out.begin, DDTV_out.begin + 256*256);
+  for(u32 x = 0; x < 256; x++){
+    for(u32 din = 0; din < 256; din++){
+      u32 dout = SBOX[x] ^ SBOX[x ^ din];
+      DDTV_out.values[next[(din << 8) | dout]++] = SBOX[(u8) x];
+    }
+  }
+}
+
+// (subset_t is returned by value, see subset_intersect for -Wpsabi)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+// DDTV_out_shifted[din][dout][c] = DDTV_out[din][dout] ^ c
+void build_DDTV_out_shifted(subset_t (*DDTV_out_shifted)[256][256], const DDTV_out_t &DDTV_out){
+  #pragma omp parallel for schedule(dynamic) if(CONFIG.parallel)
+  for(unsigned int x = 0; x < 0x100; x++){
+    for(unsigned int y = 0; y < 0x100; y++){
+      for(unsigned int c = 0; c < 0x100; c++){
+        DDTV_out_shifted[x][y][c] = subset_init_empty();
+        for(u8 elm : DDTV_out.row((x << 8) | y)){
+          DDTV_out_shifted[x][y][c] = subset_add_element(DDTV_out_shifted[x][y][c], elm ^ c);
+        }
+      }
+    }
+  }
+}
+
+// precompute y for which delta_x -S-> delat_y is possible
+void build_possible_delta_y(possible_delta_y_t &POSSIBLE_DELTA_Y, const DDTV_out_t &DDTV_out){
+  u32 n = 0;
+  for(unsigned int x = 0; x < 0x100; x++){
+    POSSIBLE_DELTA_Y.begin[x] = n;
+    for(unsigned int y = 0; y < 0x100; y++){
+      if(!DDTV_out.row((x << 8) | y).empty()){
+        POSSIBLE_DELTA_Y.values[n++] = y;
+      }
+    }
+  }
+  POSSIBLE_DELTA_Y.begin[0x100] = n;
+}
+
+// T[delta_z7][j] = union of all possible y7_j for input difference din
+// in parallel: delta_z7 = L(delta_y7) is a bijection, so the thread that
+// handles delta_y7_0 owns all entries of T with this first byte of delta_y7
+// (no races on the unions, no partial tables to merge)
+void build_T(subset_t (*T)[3], u8 din, const subset_t (*DDTV_out_shifted)[256][256], const possible_delta_y_t &POSSIBLE_DELTA_Y){
+  #pragma omp parallel for schedule(static) if(CONFIG.parallel)
+  for(u32 delta_z7 = 0; delta_z7 < (1 << 24); delta_z7++){
+    for(int j = 0; j < 3; j++){
+      T[delta_z7][j] = subset_init_empty();
+    }
+  }
+  #pragma omp parallel for schedule(dynamic) if(CONFIG.parallel)
+  for(u32 delta_y7_0 = 0; delta_y7_0 < 0x100; delta_y7_0++){
+    for(u8 dout : POSSIBLE_DELTA_Y.row(din)){
+
+      u32 delta_x7 = LUT_L_32[0][dout] ^ ((u32) din << 8);
+      u8 delta_x7_2 = (u8) delta_x7;
+      u8 delta_x7_1 = (u8) (delta_x7 >> 8);
+      u8 delta_x7_0 = (u8) (delta_x7 >> 16);
+      // delta_x7_0 -S-> delta_y7_0 impossible
+      if(subset_is_empty(DDTV_out_shifted[delta_x7_0][delta_y7_0][0])) continue;
+
+      for(u8 delta_y7_1 : POSSIBLE_DELTA_Y.row(delta_x7_1)){
+        for(u8 delta_y7_2 : POSSIBLE_DELTA_Y.row(delta_x7_2)){
+          u32 delta_y7 = ((u32) delta_y7_0 << 16) ^ ((u32) delta_y7_1 << 8) ^ (u32) delta_y7_2;
+          u32 delta_z7 = linear_layer(delta_y7);
+          T[delta_z7][0] = subset_union(T[delta_z7][0], DDTV_out_shifted[delta_x7_0][delta_y7_0][0]);
+          T[delta_z7][1] = subset_union(T[delta_z7][1], DDTV_out_shifted[delta_x7_1][delta_y7_1][0]);
+          T[delta_z7][2] = subset_union(T[delta_z7][2], DDTV_out_shifted[delta_x7_2][delta_y7_2][0]);
+        }
+      }
+    }
+  }
+}
+#pragma GCC diagnostic pop
+/////////////////////////////////////////
+// END OF PRECOMPUTATIONS              //
+/////////////////////////////////////////
+
+
+/////////////////////////////////////////
+// START OF TABLE CACHE                //
+/////////////////////////////////////////
+// The tables of step 2 are written once by `./a.out build-cache` and then
+// mmap'ed by every run, i.e., step 2 only costs page faults. With HUGE_PAGES
+// they are instead read into an arena (in parallel) s.t. T is on huge pages.
+// One file per table: a header padded to one page followed by the raw table.
+//   DDTV_out_shifted.bin  subset_t [256][256][256]
+//   T_xx.bin              subset_t [1 << 24][3] for input difference d = 0xxx
+//   Tc_xx.bin             compressed T: bitmap, index, dict[0], dict[1], dict[2]
+const u64 TABLE_CACHE_MAGIC = 0x3432504f4f4c4648; // "HFLOOP24"
+const u32 TABLE_CACHE_VERSION = 1;
+const u64 TABLE_CACHE_HEADER_SIZE = 4096;
+
+enum table_kind_t : u32 {
+  TABLE_DDTV_OUT_SHIFTED = 0,
+  TABLE_T = 1,
+  TABLE_T_COMPRESSED = 2,
+};
+
+struct table_header_t{
+  u64 magic;
+  u32 version;
+  u32 kind;
+  u32 d; // input difference (only for T)
+  u32 entry_size;
+  u64 n_entries;
+  u32 dict_size[3]; // only for compressed T
+};
+
+struct mapped_table_t{
+  void *base = nullptr; // start of the mapping (header)
+  u64 length = 0;
+  const void *data = nullptr; // start of the table
+  arena_t mem; // set (and base = mem.base) if read into memory
+};
+
+std::string table_cache_path(const char *dir, table_kind_t kind, u8 d){
+  char name[32];
+  if(kind == TABLE_T) snprintf(name, sizeof(name), "T_%02x.bin", d);
+  else if(kind == TABLE_T_COMPRESSED) snprintf(name, sizeof(name), "Tc_%02x.bin", d);
+  else snprintf(name, sizeof(name), "DDTV_out_shifted.bin");
+  return std::string(dir) + "/" + name;
+}
+
+// write the concatenation of chunks to path
+bool write_file_atomic(const std::string &path, const std::vector<std::pair<const void *, u64>> &chunks){
+  // write to a temporary file and rename it s.t. readers never see half written files
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0){
+    std::cout << "Cannot open " << tmp_path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  for(auto [chunk, length] : chunks){
+    u64 written = 0;
+    while(written < length){
+      ssize_t n = write(fd, (const u8 *) chunk + written, length - written);
+      if(n < 0){
+        if(errno == EINTR) continue;
+        std::cout << "Cannot write " << tmp_path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        unlink(tmp_path.c_str());
+        return false;
+      }
+      written += n;
+    }
+  }
+  if(fsync(fd) != 0 || close(fd) != 0 || rename(tmp_path.c_str(), path.c_str()) != 0){
+    std::cout << "Cannot finish " << path << ": " << strerror(errno) << std::endl;
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+// read the whole file at path into buf, returns false if it does not exist
+bool read_file(const std::string &path, std::vector<u8> &buf){
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+  struct stat st;
+  bool ok = fstat(fd, &st) == 0;
+  buf.resize(ok ? st.st_size : 0);
+  for(u64 done = 0; ok && done < buf.size(); ){
+    ssize_t n = pread(fd, buf.data() + done, buf.size() - done, done);
+    if(n < 0 && errno == EINTR) continue;
+    ok = n > 0;
+    done += ok ? n : 0;
+  }
+  close(fd);
+  if(!ok) std::cout << "Cannot read " << path << std::endl;
+  return ok;
+}
+
+// read length bytes of fd into p, the chunks are read by all threads
+// s.t. the pages are first touched in parallel
+bool read_parallel(int fd, u8 *p, u64 length){
+  bool ok = true;
+  #pragma omp parallel for schedule(dynamic) if(CONFIG.parallel) reduction(&&: ok)
+  for(u64 offset = 0; offset < length; offset += PAGE_2M){
+    u64 end = std::min(offset + PAGE_2M, length);
+    for(u64 done = offset; ok && done < end; ){
+      ssize_t n = pread(fd, p + done, end - done, done);
+      if(n < 0 && errno == EINTR) continue;
+      ok = n > 0;
+      done += ok ? n : 0;
+    }
+  }
+  return ok;
+}
+
+// write header and the concatenation of chunks
+bool table_cache_write(const char *dir, const table_header_t &h, const std::vector<std::pair<const void *, u64>> &chunks){
+  u8 header[TABLE_CACHE_HEADER_SIZE] = {0};
+  memcpy(header, &h, sizeof(h));
+
+  std::vector<std::pair<const void *, u64>> all = {{header, TABLE_CACHE_HEADER_SIZE}};
+  all.insert(all.end(), chunks.begin(), chunks.end());
+  return write_file_atomic(table_cache_path(dir, (table_kind_t) h.kind, h.d), all);
+}
+
+bool table_cache_write(const char *dir, table_kind_t kind, u8 d, const void *data, u32 entry_size, u64 n_entries){
+  table_header_t h = {TABLE_CACHE_MAGIC, TABLE_CACHE_VERSION, kind, d, entry_size, n_entries, {0}};
+  return table_cache_write(dir, h, {{data, n_entries * entry_size}});
+}
+
+// map a table file, its header is returned in h and must be validated by the caller
+bool table_cache_map(mapped_table_t &table, table_header_t &h, const char *dir, table_kind_t kind, u8 d){
+  std::string path = table_cache_path(dir, kind, d);
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0) return false;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (u64) st.st_size < TABLE_CACHE_HEADER_SIZE || pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+     h.magic != TABLE_CACHE_MAGIC || h.version != TABLE_CACHE_VERSION || h.kind != kind || h.d != (kind == TABLE_DDTV_OUT_SHIFTED ? 0 : d)){
+    std::cout << "Ignoring invalid table " << path << std::endl;
+    close(fd);
+    return false;
+  }
+  if(CONFIG.huge_pages){
+    arena_t mem;
+    arena_init(mem, st.st_size);
+    // the page cache keeps its copy s.t. the next run (REP, other shards on
+    // this machine) loads the table without disk IO
+    bool ok = read_parallel(fd, mem.base, st.st_size);
+    close(fd);
+    if(!ok){
+      std::cout << "Cannot read " << path << std::endl;
+      arena_free(mem);
+      return false;
+    }
+    table.mem = mem;
+    table.base = mem.base;
+  } else {
+    void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) return false;
+    // lookups into T are random, read ahead only wastes IO
+    if(kind != TABLE_DDTV_OUT_SHIFTED) madvise(base, st.st_size, MADV_RANDOM);
+    table.base = base;
+  }
+  table.length = st.st_size;
+  table.data = (const u8 *) table.base + TABLE_CACHE_HEADER_SIZE;
+  return true;
+}
+
+void table_cache_unmap(mapped_table_t &table){
+  if(table.mem.base != nullptr) arena_free(table.mem);
+  else if(table.base != nullptr) munmap(table.base, table.length);
+  table = mapped_table_t();
+}
+
+bool table_cache_map(mapped_table_t &table, const char *dir, table_kind_t kind, u8 d, u32 entry_size, u64 n_entries){
+  table_header_t h;
+  if(!table_cache_map(table, h, dir, kind, d)) return false;
+  if(h.entry_size != entry_size || h.n_entries != n_entries || table.length != TABLE_CACHE_HEADER_SIZE + n_entries * entry_size){
+    std::cout << "Ignoring invalid table " << table_cache_path(dir, kind, d) << std::endl;
+    table_cache_unmap(table);
+    return false;
+  }
+  return true;
+}
+
+/////////////////////////////////////////
+// END OF TABLE CACHE                  //
+/////////////////////////////////////////
+
+
+/////////////////////////////////////////
+// START OF COMPRESSED T               //
+/////////////////////////////////////////
+// Alternative layout of T for one pair: the distinct subsets of byte j
+// are stored once in dict[j] and an entry (delta_z7, j) is a 24 bit index
+// into dict[j] (index 0 is the empty set). The three bytes of an entry are
+// always either all empty or all non-empty, the non-empty entries are
+// additionally marked in a bitmap for fast rejection without any lookup.
+const u64 COMPRESSED_T_BITMAP_SIZE = (1 << 24) / 8;
+// 3 x 24 bit per delta_z7, padded s.t. every index can be read as u32
+const u64 COMPRESSED_T_INDEX_SIZE = ((9 << 24) + 4 + 4095) & ~(u64) 4095;
+
+struct compressed_T_t{
+  const u64 *nonempty = nullptr;
+  const u8 *index = nullptr;
+  const subset_t *dict[3] = {nullptr};
+  u32 dict_size[3] = {0};
+  mapped_table_t map; // set if mapped from the table cache
+  arena_t mem; // set if built by compress_T
+};
+
+inline bool compressed_T_nonempty(const compressed_T_t &T, u32 delta_z7){
+  return (T.nonempty[delta_z7 >> 6] >> (delta_z7 & 63)) & 1;
+}
+
+inline const subset_t *compressed_T_lookup(const compressed_T_t &T, u32 delta_z7, int j){
+  u32 idx;
+  memcpy(&idx, T.index + 9*delta_z7 + 3*j, 4);
+  return &T.dict[j][idx & 0xFFFFFF];
+}
+
+u64 compressed_T_bytes(const compressed_T_t &T){
+  return COMPRESSED_T_BITMAP_SIZE + COMPRESSED_T_INDEX_SIZE + ((u64) T.dict_size[0] + T.dict_size[1] + T.dict_size[2]) * sizeof(subset_t);
+}
+
+// (subset_t is returned by value, see subset_intersect for -Wpsabi)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+// deduplicate the subsets of a full T
+// (CT is placed in one arena of the exact size once the dictionaries are known)
+// returns false if a dictionary does not fit into 24 bit indexes
+bool compress_T(compressed_T_t &CT, const subset_t (*T)[3]){
+  std::vector<u8> index(COMPRESSED_T_INDEX_SIZE, 0);
+  std::vector<u32> first_occurrence[3]; // delta_z7 of each dict entry
+
+  // the three dictionaries are built in parallel (with one hash table each)
+  const u32 HASH_BITS = 25;
+  #pragma omp parallel for schedule(dynamic) if(CONFIG.parallel)
+  for(int j = 0; j < 3; j++){
+    // open addressing hash table: slot -> dict index (0 = free slot, as the
+    // empty set is always dict entry 0 and never inserted)
+    u32 *slots = new u32 [1 << HASH_BITS]();
+    first_occurrence[j] = {0};
+    for(u32 delta_z7 = 0; delta_z7 < (1 << 24); delta_z7++){
+      const subset_t &a = T[delta_z7][j];
+      u32 idx = 0;
+      if(!subset_is_empty(a)){
+        u64 h = (u64) a[0] ^ ((u64) a[1] * 0x9E3779B97F4A7C15) ^ ((u64) a[2] * 0xC2B2AE3D27D4EB4F) ^ ((u64) a[3] * 0x165667B19E3779F9);
+        u32 slot = (h * 0xFF51AFD7ED558CCD) >> (64 - HASH_BITS);
+        while(slots[slot] != 0){
+          const subset_t &b = T[first_occurrence[j][slots[slot]]][j];
+          if(subset_is_empty(a ^ b)) break;
+          slot = (slot + 1) & ((1 << HASH_BITS) - 1);
+        }
+        if(slots[slot] == 0){
+          slots[slot] = first_occurrence[j].size();
+          first_occurrence[j].push_back(delta_z7);
+        }
+        idx = slots[slot];
+      }
+      index[9*delta_z7 + 3*j + 0] = (u8) idx;
+      index[9*delta_z7 + 3*j + 1] = (u8) (idx >> 8);
+      index[9*delta_z7 + 3*j + 2] = (u8) (idx >> 16);
+    }
+    CT.dict_size[j] = first_occurrence[j].size();
+    delete[](slots);
+  }
+  for(int j = 0; j < 3; j++){
+    if(first_occurrence[j].size() > (1 << 24)){
+      std::cout << "Compressed T: dictionary " << j << " has " << first_occurrence[j].size() << " entries, more than 2**24" << std::endl;
+      CT = compressed_T_t();
+      return false;
+    }
+  }
+
+  // + alignment of the dictionaries
+  arena_init(CT.mem, compressed_T_bytes(CT) + 3*64);
+  u64 *nonempty = arena_new<u64>(CT.mem, COMPRESSED_T_BITMAP_SIZE / 8);
+  // one word per iteration s.t. no two threads write the same word
+  #pragma omp parallel for schedule(static) if(CONFIG.parallel)
+  for(u32 w = 0; w < (1 << 24) / 64; w++){
+    for(u32 delta_z7 = 64*w; delta_z7 < 64*w + 64; delta_z7++){
+      if(!subset_is_empty(T[delta_z7][0])) nonempty[w] |= (u64) 1 << (delta_z7 & 63);
+    }
+  }
+  CT.nonempty = nonempty;
+  u8 *index_ = arena_new<u8>(CT.mem, COMPRESSED_T_INDEX_SIZE);
+  memcpy(index_, index.data(), COMPRESSED_T_INDEX_SIZE);
+  CT.index = index_;
+  for(int j = 0; j < 3; j++){
+    subset_t *dict = arena_new<subset_t>(CT.mem, CT.dict_size[j]);
+    dict[0] = subset_init_empty();
+    for(u32 idx = 1; idx < CT.dict_size[j]; idx++) dict[idx] = T[first_occurrence[j][idx]][j];
+    CT.dict[j] = dict;
+  }
+  return true;
+}
+#pragma GCC diagnostic pop
+
+void compressed_T_free(compressed_T_t &CT){
+  table_cache_unmap(CT.map);
+  arena_free(CT.mem);
+  CT = compressed_T_t();
+}
+bool table_cache_write_compressed_T(const char *dir, u8 d, const compressed_T_t &CT){
+  table_header_t h = {TABLE_CACHE_MAGIC, TABLE_CACHE_VERSION, TABLE_T_COMPRESSED, d, 9, 1 << 24,
+                      {CT.dict_size[0], CT.dict_size[1], CT.dict_size[2]}};
+  return table_cache_write(dir, h, {{CT.nonempty, COMPRESSED_T_BITMAP_SIZE}, {CT.index, COMPRESSED_T_INDEX_SIZE},
+                                    {CT.dict[0], (u64) CT.dict_size[0] * sizeof(subset_t)},
+                                    {CT.dict[1], (u64) CT.dict_size[1] * sizeof(subset_t)},
+                                    {CT.dict[2], (u64) CT.dict_size[2] * sizeof(subset_t)}});
+}
+
+bool table_cache_map_compressed_T(compressed_T_t &CT, const char *dir, u8 d){
+  table_header_t h;
+  if(!table_cache_map(CT.map, h, dir, TABLE_T_COMPRESSED, d)) return false;
+  bool valid = h.entry_size == 9 && h.n_entries == (1 << 24);
+  for(int j = 0; j < 3; j++){
+    CT.dict_size[j] = h.dict_size[j];
+    // every dictionary holds at least the empty set
+    valid = valid && h.dict_size[j] >= 1 && h.dict_size[j] <= (1 << 24);
+  }
+  valid = valid && CT.map.length == TABLE_CACHE_HEADER_SIZE + compressed_T_bytes(CT);
+  if(valid){
+    const u8 *p = (const u8 *) CT.map.data;
+    CT.nonempty = (const u64 *) p;
+    p += COMPRESSED_T_BITMAP_SIZE;
+    CT.index = p;
+    p += COMPRESSED_T_INDEX_SIZE;
+    for(int j = 0; j < 3; j++){
+      CT.dict[j] = (const subset_t *) p;
+      p += (u64) CT.dict_size[j] * sizeof(subset_t);
+    }
+    // one pass over the index: every index is inside its dictionary and
+    // non-empty exactly for the rows marked in the bitmap
+    u64 n_bad = 0;
+    #pragma omp parallel for schedule(static) reduction(+:n_bad) if(CONFIG.parallel)
+    for(u32 delta_z7 = 0; delta_z7 < (1 << 24); delta_z7++){
+      const bool nonempty = compressed_T_nonempty(CT, delta_z7);
+      for(int j = 0; j < 3; j++){
+        const u8 *e = CT.index + 9*delta_z7 + 3*j;
+        const u32 idx = e[0] | (u32) e[1] << 8 | (u32) e[2] << 16;
+        n_bad += idx >= CT.dict_size[j] || (idx != 0) != nonempty;
+      }
+    }
+    valid = n_bad == 0;
+  }
+  if(!valid){
+    std::cout << "Ignoring invalid table " << table_cache_path(dir, TABLE_T_COMPRESSED, d) << std::endl;
+    table_cache_unmap(CT.map);
+    CT = compressed_T_t();
+    return false;
+  }
+  return true;
+}
+
+/////////////////////////////////////////
+// END OF COMPRESSED T                 //
+/////////////////////////////////////////
+
+
+/////////////////////////////////////////
+// START OF PERF COUNTERS              //
+/////////////////////////////////////////
+// With PERF, every omp thread counts its own cycles, instructions, last level
+// cache (read) misses, dTLB (read) misses and branch misses of step 2 and of
+// step 3 in user space (see perf_event_open(2)); the omp threads are kept
+// alive between the parallel regions, so the counters opened by a thread in
+// perf_open follow the work of that thread in all later regions. Counters
+// are scaled by their enabled / running time if the kernel multiplexes them,
+// counters the CPU or the kernel does not provide (perf_event_paranoid, most
+// VMs) are reported as n/a. The task clock is a software counter.
+enum perf_counter_t {
+  PERF_TASK_CLOCK = 0,
+  PERF_CYCLES = 1,
+  PERF_INSTRUCTIONS = 2,
+  PERF_LLC_MISSES = 3,
+  PERF_DTLB_MISSES = 4,
+  PERF_BRANCH_MISSES = 5,
+};
+const int N_PERF_COUNTERS = 6;
+const char *PERF_COUNTER_NAMES[N_PERF_COUNTERS] = {"task clock (ns)", "cycles", "instructions", "LLC misses", "dTLB misses", "branch misses"};
+
+struct perf_counters_t{
+  int n_threads = 0;
+  // fd[k * N_PERF_COUNTERS + c] for counter c of omp thread k, -1 if not available
+  std::vector<int> fd;
+};
+
+perf_event_attr perf_counter_attr(int c){
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  const u64 read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  switch(c){
+    case PERF_TASK_CLOCK:    attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_TASK_CLOCK; break;
+    case PERF_CYCLES:        attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PERF_INSTRUCTIONS:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PERF_LLC_MISSES:    attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_LL | read_miss; break;
+    case PERF_DTLB_MISSES:   attr.type = PERF_TYPE_HW_CACHE; attr.config = PERF_COUNT_HW_CACHE_DTLB | read_miss; break;
+    case PERF_BRANCH_MISSES: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+  }
+  return attr;
+}
+
+// opens the (disabled) counters of all omp threads
+void perf_open(perf_counters_t &pc){
+  pc.n_threads = omp_get_max_threads();
+  pc.fd.assign(pc.n_threads * N_PERF_COUNTERS, -1);
+  int error[N_PERF_COUNTERS] = {0};
+  #pragma omp parallel if(CONFIG.parallel)
+  {
+    const int k = omp_get_thread_num();
+    for(int c = 0; c < N_PERF_COUNTERS; c++){
+      perf_event_attr attr = perf_counter_attr(c);
+      const int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+      pc.fd[k * N_PERF_COUNTERS + c] = fd;
+      if(fd < 0 && k == 0) error[c] = errno;
+    }
+  }
+  for(int c = 0; c < N_PERF_COUNTERS; c++){
+    if(error[c]) std::cout << "perf_event_open failed for " << PERF_COUNTER_NAMES[c] << ": " << strerror(error[c]) << std::endl;
+  }
+}
+
+// resets and starts (on = true) or stops the counters of all threads
+void perf_enable(const perf_counters_t &pc, bool on){
+  for(int fd : pc.fd){
+    if(fd < 0) continue;
+    if(on) ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+  }
+}
+
+void perf_close(perf_counters_t &pc){
+  for(int fd : pc.fd) if(fd >= 0) close(fd);
+  pc.fd.clear();
+}
+
+// scaled value of counter c of thread k, false if not available
+bool perf_read(const perf_counters_t &pc, int k, int c, double &value){
+  const int fd = pc.fd[k * N_PERF_COUNTERS + c];
+  u64 buf[3]; // value, time enabled, time running
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)) return false;
+  value = buf[2] ? (double) buf[0] * buf[1] / buf[2] : 0;
+  return true;
+}
+
+// per guess if n_guesses > 0, and per thread if there are several
+void perf_report(const perf_counters_t &pc, const char *step, u64 n_guesses){
+  std::cout << "Perf counters of " << step << " (user space, " << std::dec << pc.n_threads << " threads):" << std::endl;
+  double total[N_PERF_COUNTERS] = {0};
+  bool available[N_PERF_COUNTERS];
+  for(int c = 0; c < N_PERF_COUNTERS; c++){
+    std::vector<double> per_thread(pc.n_threads, 0);
+    available[c] = false;
+    for(int k = 0; k < pc.n_threads; k++){
+      if(perf_read(pc, k, c, per_thread[k])){
+        available[c] = true;
+        total[c] += per_thread[k];
+      }
+    }
+    std::cout << "  " << std::left << std::setw(16) << PERF_COUNTER_NAMES[c] << std::right;
+    if(!available[c]){
+      std::cout << "n/a" << std::endl;
+      continue;
+    }
+    std::cout << std::setprecision(4) << std::setw(12) << total[c];
+    if(n_guesses) std::cout << " = " << std::setw(10) << total[c] / n_guesses << " per guess";
+    if(pc.n_threads > 1){
+      std::cout << "  (threads:";
+      for(double v : per_thread) std::cout << " " << v;
+      std::cout << ")";
+    }
+    std::cout << std::setprecision(6) << std::endl;
+  }
+  if(available[PERF_CYCLES] && available[PERF_INSTRUCTIONS]){
+    std::cout << "  instructions per cycle: " << std::setprecision(3) << total[PERF_INSTRUCTIONS] / std::max(total[PERF_CYCLES], 1.0) << std::setprecision(6) << std::endl;
+  }
+}
+
+/////////////////////////////////////////
+// END OF PERF COUNTERS                //
+/////////////////////////////////////////
+
+
+/////////////////////////////////////////
+// START OF ORACLE                     //
+/////////////////////////////////////////
+// The encryption oracle of the CPA setting as a separate process that holds
+// the key (./a.out oracle, see run_oracle) and answers batches of queries on
+// the Unix domain socket ORACLE. A request is an oracle_request_t followed by
+// the n plaintexts (u32) and the n tweaks (u64), the answer are the n
+// ciphertexts (u32): both sides use the arrays of encrypt_batch as they are,
+// the oracle receives into them, encrypts in place and sends the plaintext
+// array back. Pin attacker and oracle to different cores with taskset.
+const u32 ORACLE_MAGIC = 0x51464c48; // "HLFQ"
+
+struct oracle_request_t{
+  u32 magic;
+  u32 n; // <= ORACLE_MAX_BATCH
+};
+
+// client side of ORACLE
+struct oracle_t{
+  int fd = -1;
+  u64 n_queries = 0;
+  u64 n_batches = 0;
+  nanoseconds time = 0ns; // from sending a batch to its answer
+  ~oracle_t(){ if(fd >= 0) close(fd); }
+};
+
+bool send_all(int fd, const void *p, u64 length){
+  for(u64 sent = 0; sent < length; ){
+    ssize_t n = send(fd, (const u8 *) p + sent, length - sent, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR) continue;
+    if(n < 0) return false;
+    sent += n;
+  }
+  return true;
+}
+
+// false on errors and if the peer closed the connection
+bool recv_all(int fd, void *p, u64 length){
+  for(u64 received = 0; received < length; ){
+    ssize_t n = recv(fd, (u8 *) p + received, length - received, 0);
+    if(n < 0 && errno == EINTR) continue;
+    if(n <= 0) return false;
+    received += n;
+  }
+  return true;
+}
+
+bool oracle_address(sockaddr_un &addr, const std::string &path){
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(path.size() >= sizeof(addr.sun_path)){
+    std::cout << "ORACLE socket path too long: " << path << std::endl;
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+bool oracle_connect(oracle_t &o, const std::string &path){
+  sockaddr_un addr;
+  if(!oracle_address(addr, path)) return false;
+  o.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(o.fd < 0 || connect(o.fd, (const sockaddr *) &addr, sizeof(addr)) != 0){
+    std::cout << "Cannot connect to the oracle at " << path << ": " << strerror(errno) << std::endl;
+    if(o.fd >= 0) close(o.fd);
+    o.fd = -1;
+    return false;
+  }
+  return true;
+}
+
+// state[k] = encrypt(state[k], key of the oracle, seed[k]) for k < n
+bool oracle_encrypt(oracle_t &o, u32 *state, const u64 *seed, u64 n){
+  for(u64 k = 0; k < n; k += ORACLE_MAX_BATCH){
+    const oracle_request_t h = {ORACLE_MAGIC, (u32) std::min<u64>(n - k, ORACLE_MAX_BATCH)};
+    const auto start = steady_clock::now();
+    errno = 0;
+    if(!send_all(o.fd, &h, sizeof(h)) || !send_all(o.fd, state + k, h.n * sizeof(u32)) || !send_all(o.fd, seed + k, h.n * sizeof(u64)) ||
+       !recv_all(o.fd, state + k, h.n * sizeof(u32))){
+      std::cout << "Oracle query failed: " << (errno ? strerror(errno) : "connection closed") << std::endl;
+      return false;
+    }
+    o.time += steady_clock::now() - start;
+    o.n_queries += h.n;
+    o.n_batches++;
+  }
+  return true;
+}
+
+void oracle_close(oracle_t &o){
+  if(o.fd >= 0) close(o.fd);
+  o.fd = -1;
+}
+
+// answers the batches of one client until it disconnects
+void oracle_serve(int fd, u128 key, int client){
+  std::vector<u32> state;
+  std::vector<u64> seed;
+  std::vector<u128> keys;
+  u64 n_queries = 0, n_batches = 0;
+  oracle_request_t h;
+  while(recv_all(fd, &h, sizeof(h))){
+    if(h.magic != ORACLE_MAGIC || h.n > ORACLE_MAX_BATCH){
+      std::cout << "Oracle client " << client << ": invalid request" << std::endl;
+      break;
+    }
+    state.resize(h.n);
+    seed.resize(h.n);
+    if(keys.size() < h.n) keys.resize(h.n, key);
+    if(!recv_all(fd, state.data(), h.n * sizeof(u32)) || !recv_all(fd, seed.data(), h.n * sizeof(u64))) break;
+    // bitsliced in blocks of BS_LANES, the rest one by one
+    const u32 m = h.n - h.n % BS_LANES;
+    encrypt_batch(state.data(), keys.data(), seed.data(), m);
+    for(u32 k = m; k < h.n; k++) state[k] = encrypt(state[k], key, seed[k]);
+    if(!send_all(fd, state.data(), h.n * sizeof(u32))) break;
+    n_queries += h.n;
+    n_batches++;
+  }
+  close(fd);
+  std::cout << "Oracle client " << client << ": " << std::dec << n_queries << " queries in " << n_batches << " batches" << std::endl;
+}
+
+/////////////////////////////////////////
+// END OF ORACLE                       //
+/////////////////////////////////////////
+
+
+/////////////////////////////////////////
+// START OF NEW ATTACK                 //
+/////////////////////////////////////////
+
+u32 normalize_round_key(u32 round_key, u64 seed, u8 round){
+  // self inverse
+  switch (round) {
+  case 0: return round_key ^ (seed >> 40);
+  case 1: return round_key ^ ((seed >> 16) & 0xFFFFFF);
+  case 2: return round_key ^ ((seed & 0xFFFF) << 8);
+  case 3: return round_key;
+  case 4: return round_key;
+  case 5: return round_key ^ (seed >> 48);
+  case 6: return round_key ^ (((seed >> 32) & 0xFFFF) << 16) ^ ((seed >> 56) ^ ((seed >> 40) & 0xFF));
+  case 7: return round_key ^ ((seed >> 32) & 0xFFFFFF) ^ (seed & 0xFFFFFF);
+  case 8: return round_key ^ ((seed >> 40) & 0xFFFFFF) ^ ((seed >> 8) & 0xFFFFFF);
+  case 9: return round_key ^ ((seed >> 16) & 0xFFFFFF) ^ ((seed & 0xFF) << 16) ^ (seed >> 48);
+  case 10: return round_key ^ ((((seed >> 32) & 0xFFFF) ^ (seed & 0xFFFF)) << 8) ^ (seed >> 56);
+  default: return 0;
+  }
+}
+
+u32 normalize_round_key_10(u32 round_key, u8 last_byte_round_key_9, u64 seed){
+  return round_key ^ ((((seed >> 32) & 0xFFFF) ^ (seed & 0xFFFF)) << 8) ^ (seed >> 56) ^ SBOX[last_byte_round_key_9] ^ SBOX[last_byte_round_key_9 ^ ((seed >> 48) & 0xFF) ^ ((seed >> 16) & 0xFF)];
+}
+struct pair_t{
+  u32 p : 24; // plaintext
+  u64 t; // tweak = seed
+  u8 d; // delta
+  u32 c : 24; // ciphertext
+  u32 c_prime : 24; // ciphertext'
+};
+
+// step 4: brute force the remaining key bits
+// A candidate ((L^-1 rk7)_0, rk8, rk9, rk10) fixes all but 48 bits of the key
+// (see master_key_from_round_keys): the 16 unknown bits u of L^-1(rk7), rk6
+// and k = K'[119:112]. Every guess is checked on the first pair by meeting in
+// the middle: six rounds are decrypted (rk7 and rk6 in the outer loops) and
+// four rounds are encrypted with the round keys 0 to 4 of the guessed key.
+struct key_candidate_t{
+  // round keys for seed 0
+  u8 L_inv_rk7_0;
+  u32 rk8;
+  u32 rk9;
+  u32 rk10;
+};
+
+// additional (plaintext, tweak, ciphertext) for verifying recovered keys
+struct query_t{
+  u32 p : 24;
+  u64 t;
+  u32 c : 24;
+};
+
+// check a master key against all pairs and the verification queries
+bool check_master_key(u128 master_key, const std::vector<pair_t> &PAIRS, const std::vector<query_t> &queries){
+  for(const pair_t &pair : PAIRS){
+    if(encrypt(pair.p, master_key, pair.t) != pair.c) return false;
+    if(encrypt(pair.p ^ (u32) pair.d, master_key, pair.t ^ ((u64) pair.d << 40)) != pair.c_prime) return false;
+  }
+  for(const query_t &q : queries){
+    if(encrypt(q.p, master_key, q.t) != q.c) return false;
+  }
+  return true;
+}
+
+// enumerate (u, rk6, k) for one candidate, returns true and sets master_key on success
+// if correct_guess = {u, rk6, k} is given it is checked first (see CHECK_CORRECT_FIRST)
+bool recover_master_key(u128 &master_key, const key_candidate_t &cand, const std::vector<pair_t> &PAIRS, const std::vector<query_t> &queries, const u32 *correct_guess){
+  // use the round keys for the seed of the first pair, i.e.,
+  // recover K ^ (seed << 64) with seed 0
+  const u64 seed = PAIRS[0].t;
+  const u32 rk9 = normalize_round_key(cand.rk9, seed, 9);
+  const u32 rk10 = normalize_round_key_10(cand.rk10, (u8) rk9, seed);
+  const u32 rk8 = normalize_round_key(cand.rk8, seed, 8);
+  const u32 L_inv_rk7_0 = cand.L_inv_rk7_0 ^ (u8) (inv_linear_layer(normalize_round_key(0, seed, 7)) >> 16);
+  const u32 p = PAIRS[0].p;
+  const u32 x7 = inv_round_with_MC(inv_round_with_MC(inv_round_no_MC(PAIRS[0].c, rk10), rk9), rk8);
+  // rk5 = K[7:0] || K'[127:120] || k where K[7:0] = W3[7:0] and K'[127:120] do not depend on the guess
+  const u128 K0 = master_key_from_round_keys(0, 0, rk8, rk9, rk10, 0);
+  const u32 W3 = (u32) K0;
+  const u32 rk5_ = ((W3 & 0xFF) << 16) ^ ((((u32) (K0 >> 120)) ^ (g(W3, 1) >> 24)) << 8);
+
+  auto test = [&](u32 rk7, u32 rk6, u8 k, u32 x5) -> bool {
+    u32 x4 = inv_round_with_MC(x5, rk5_ ^ k);
+    u128 K = master_key_from_round_keys(rk6, rk7, rk8, rk9, rk10, k);
+    u32 state = p ^ (u32) (K >> 104);
+    state = round_with_MC(state, (K >> 80) & 0xFFFFFF);
+    state = round_with_MC(state, (K >> 56) & 0xFFFFFF);
+    state = round_with_MC(state, (K >> 32) & 0xFFFFFF);
+    state = round_with_MC(state, (K >> 8) & 0xFFFFFF);
+    if(state != x4) return false;
+    // 24 bit filter passed, check the full key
+    return check_master_key(K ^ ((u128) seed << 64), PAIRS, queries);
+  };
+
+  if(correct_guess != nullptr){
+    u32 rk7 = linear_layer((L_inv_rk7_0 << 16) ^ correct_guess[0]);
+    u32 rk6 = correct_guess[1];
+    u32 x5 = inv_round_with_MC(inv_round_with_MC(x7, rk7), rk6);
+    if(test(rk7, rk6, correct_guess[2], x5)){
+      master_key = master_key_from_round_keys(rk6, rk7, rk8, rk9, rk10, correct_guess[2]) ^ ((u128) seed << 64);
+      return true;
+    }
+  }
+
+  std::atomic<bool> found(false);
+  #pragma omp parallel for schedule(dynamic) if(CONFIG.parallel)
+  for(u32 u = 0; u < CONFIG.max_rk7; u++){
+    if(found.load(std::memory_order_relaxed)) continue;
+    u32 rk7 = linear_layer((L_inv_rk7_0 << 16) ^ u);
+    u32 x6 = inv_round_with_MC(x7, rk7);
+    for(u32 rk6 = 0; rk6 < CONFIG.max_rk6; rk6++){
+      if(found.load(std::memory_order_relaxed)) break;
+      u32 x5 = inv_round_with_MC(x6, rk6);
+      for(u32 k = 0; k < 0x100; k++){
+        if(test(rk7, rk6, k, x5)){
+          // only the first hit sets master_key
+          #pragma omp critical(recover_master_key)
+          {
+            bool expected = false;
+            if(found.compare_exchange_strong(expected, true)){
+              master_key = master_key_from_round_keys(rk6, rk7, rk8, rk9, rk10, k) ^ ((u128) seed << 64);
+            }
+          }
+          break;
+        }
+      }
+    }
+  }
+  return found;
+}
+
+// step 4 enumerates (L^-1 rk7)_{1,2} < MAX_RK7, rk6 < MAX_RK6 and k, i.e., all
+// 2**48 keys of a candidate only with MAX_RK7 = 0x10000 and MAX_RK6 = 0x1000000
+bool step4_is_partial(){
+  return CONFIG.max_rk7 * CONFIG.max_rk6 * 0x100 < ((u64) 1 << 48);
+}
+
+void step4_report_keys(u64 n_candidates){
+  std::cout << "Checking " << std::dec << n_candidates << " candidates with " << CONFIG.max_rk7 * CONFIG.max_rk6 * 0x100 << " of 2**48 keys each";
+  if(step4_is_partial()){
+    std::cout << " (only a part of step 4, the timings do not include the full brute force: set MAX_RK7 = 0x10000 and MAX_RK6 = 0x1000000)";
+  }
+  std::cout << "." << std::endl;
+}
+
+// CANDIDATES file: bin is a candidate_file_header_t, the pairs and then one
+// candidate_record_t per candidate; jsonl is one JSON object per line
+// (in both, the candidates of a thread are in order, the threads interleave),
+// every candidate survived the filters of all pairs
+const u64 CANDIDATES_MAGIC = 0x31444e41434c4648; // "HFLCAND1"
+const u32 CANDIDATES_VERSION = 2;
+
+struct candidate_file_header_t{
+  u64 magic;
+  u32 version;
+  u32 n_pairs;
+};
+
+struct candidate_record_t{
+  // key_candidate_t
+  u32 rk8;
+  u32 rk9;
+  u32 rk10;
+  // the guess of step 3 that produced it (normalised for the seed of pair 0)
+  u32 rk10_;
+  u32 L_inv_rk9_;
+  u8 L_inv_rk7_0;
+  u8 reserved[3];
+};
+
+// step 3 threads push their candidates into their own ring buffer (no locks),
+// a writer thread drains the rings into CANDIDATES, a thread only waits if
+// its ring is full
+const u32 CANDIDATE_RING_SIZE = 1 << 12;
+
+struct candidate_ring_t{
+  alignas(64) std::atomic<u64> head; // written by the step 3 thread
+  alignas(64) std::atomic<u64> tail; // written by the writer thread
+  candidate_record_t records[CANDIDATE_RING_SIZE];
+};
+
+struct candidate_sink_t{
+  int fd = -1;
+  bool jsonl;
+  std::vector<u8> d; // delta of pair i for jsonl
+  int n_rings;
+  candidate_ring_t *rings;
+  std::atomic<bool> stop;
+  std::thread writer;
+  std::mutex drain_mutex; // the writer thread or candidate_sink_flush
+  u64 n_written;
+  u64 length; // of the file
+  bool failed; // a write failed, the file is incomplete
+};
+
+// write everything or complain
+bool write_all(int fd, const void *p, u64 length){
+  for(u64 written = 0; written < length; ){
+    ssize_t n = write(fd, (const u8 *) p + written, length - written);
+    if(n < 0 && errno == EINTR) continue;
+    if(n < 0){
+      std::cout << "Cannot write candidates: " << strerror(errno) << std::endl;
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+void candidate_record_jsonl(const candidate_sink_t &sink, const candidate_record_t &r, std::string &out){
+  char line[256];
+  int n = snprintf(line, sizeof(line), "{\"L_inv_rk7_0\":%u,\"rk8\":%u,\"rk9\":%u,\"rk10\":%u,\"rk10_guess\":%u,\"rk9_guess\":%u,\"pairs\":[",
+                   r.L_inv_rk7_0, r.rk8, r.rk9, r.rk10, r.rk10_, r.L_inv_rk9_);
+  out.append(line, n);
+  const char *sep = "";
+  for(u32 i = 0; i < sink.d.size(); i++){
+    n = snprintf(line, sizeof(line), "%s{\"i\":%u,\"d\":%u}", sep, i, sink.d[i]);
+    out.append(line, n);
+    sep = ",";
+  }
+  out += "]}\n";
+}
+
+// move the records of all rings to the file, returns false if there were none
+// (after a failed write the records are dropped s.t. step 3 does not block)
+bool candidate_sink_drain(candidate_sink_t &sink, std::string &out){
+  out.clear();
+  u64 n = 0;
+  for(int k = 0; k < sink.n_rings; k++){
+    candidate_ring_t &ring = sink.rings[k];
+    const u64 tail = ring.tail.load(std::memory_order_relaxed);
+    const u64 head = ring.head.load(std::memory_order_acquire);
+    for(u64 j = tail; j < head; j++){
+      const candidate_record_t &r = ring.records[j % CANDIDATE_RING_SIZE];
+      if(sink.jsonl) candidate_record_jsonl(sink, r, out);
+      else out.append((const char *) &r, sizeof(r));
+    }
+    ring.tail.store(head, std::memory_order_release);
+    n += head - tail;
+  }
+  if(n != 0 && !sink.failed){
+    if(write_all(sink.fd, out.data(), out.size())) sink.n_written += n, sink.length += out.size();
+    else sink.failed = true;
+  }
+  return n != 0;
+}
+
+void candidate_sink_writer(candidate_sink_t *sink){
+  std::string out;
+  while(!sink->stop.load(std::memory_order_acquire)){
+    bool drained;
+    {
+      std::lock_guard<std::mutex> lock(sink->drain_mutex);
+      drained = candidate_sink_drain(*sink, out);
+    }
+    if(!drained) std::this_thread::sleep_for(1ms);
+  }
+  while(candidate_sink_drain(*sink, out));
+}
+
+// resumed runs (append) cut the file to length, the length saved with their
+// last checkpoint (this also drops a record the killed run only wrote in
+// part), the rows that were not in it are reported again
+bool candidate_sink_open(candidate_sink_t &sink, const std::string &path, const std::string &format,
+                         const std::vector<pair_t> &PAIRS, int n_threads, bool append, u64 length){
+  sink.jsonl = format == "jsonl";
+  sink.fd = open(path.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+  if(sink.fd < 0){
+    std::cout << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  struct stat st;
+  if(fstat(sink.fd, &st) != 0){
+    std::cout << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+    close(sink.fd);
+    return false;
+  }
+  sink.length = 0;
+  if(append){
+    if((u64) st.st_size < length){
+      std::cout << "Candidates " << path << " are shorter than in the checkpoint" << std::endl;
+      close(sink.fd);
+      return false;
+    }
+    if(ftruncate(sink.fd, length) != 0){
+      std::cout << "Cannot truncate " << path << ": " << strerror(errno) << std::endl;
+      close(sink.fd);
+      return false;
+    }
+    sink.length = length;
+  }
+  if(!sink.jsonl && sink.length == 0){
+    candidate_file_header_t h = {CANDIDATES_MAGIC, CANDIDATES_VERSION, (u32) PAIRS.size()};
+    if(!write_all(sink.fd, &h, sizeof(h)) || !write_all(sink.fd, PAIRS.data(), PAIRS.size() * sizeof(pair_t))){
+      close(sink.fd);
+      return false;
+    }
+    sink.length = sizeof(h) + PAIRS.size() * sizeof(pair_t);
+  }
+  for(const pair_t &pair : PAIRS) sink.d.push_back(pair.d);
+  sink.n_rings = n_threads;
+  sink.rings = new candidate_ring_t[n_threads];
+  for(int k = 0; k < n_threads; k++){
+    sink.rings[k].head.store(0);
+    sink.rings[k].tail.store(0);
+  }
+  sink.n_written = 0;
+  sink.failed = false;
+  sink.stop.store(false);
+  sink.writer = std::thread(candidate_sink_writer, &sink);
+  return true;
+}
+
+// called by step 3 thread k only
+void candidate_sink_push(candidate_sink_t &sink, int k, const candidate_record_t &r){
+  candidate_ring_t &ring = sink.rings[k];
+  const u64 head = ring.head.load(std::memory_order_relaxed);
+  while(head - ring.tail.load(std::memory_order_acquire) >= CANDIDATE_RING_SIZE) std::this_thread::yield();
+  ring.records[head % CANDIDATE_RING_SIZE] = r;
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+// moves the records pushed so far to the file and syncs it (before a
+// checkpoint marks their rows as done), returns false if the file is incomplete
+bool candidate_sink_flush(candidate_sink_t &sink){
+  std::lock_guard<std::mutex> lock(sink.drain_mutex);
+  std::string out;
+  candidate_sink_drain(sink, out);
+  if(!sink.failed && fsync(sink.fd) != 0){
+    std::cout << "Cannot sync candidates: " << strerror(errno) << std::endl;
+    sink.failed = true;
+  }
+  return !sink.failed;
+}
+
+// writes the remaining records and closes the file, returns false if the
+// file is incomplete
+bool candidate_sink_close(candidate_sink_t &sink){
+  if(sink.fd < 0) return true;
+  sink.stop.store(true, std::memory_order_release);
+  sink.writer.join();
+  bool ok = !sink.failed;
+  if(fsync(sink.fd) != 0 || close(sink.fd) != 0){
+    std::cout << "Cannot finish candidates: " << strerror(errno) << std::endl;
+    ok = false;
+  }
+  sink.fd = -1;
+  delete[] sink.rings;
+  return ok;
+}
+
+// step 3: everything needed to check a guess (rk10, L^-1 rk9),
+// both normalised for the seed of the first pair
+struct step3_ctx_t{
+  // the pairs in the order of the rk8 filter: PAIRS[i] is pair pair_order[i]
+  // of the attack (see step3_filter_order), the guesses and candidates are
+  // normalised for the tweak t_0 of its pair 0 in any order
+  pair_t PAIRS[MAX_N_PAIRS];
+  u8 pair_order[MAX_N_PAIRS];
+  u64 t_0;
+  const subset_t (*DDTV_out_shifted)[256][256];
+  // T of pair i, either full (T) or compressed (CT) depending on COMPRESSED_T
+  const subset_t (*T[MAX_N_PAIRS])[3];
+  const compressed_T_t *CT[MAX_N_PAIRS];
+  // normalization terms
+  u32 norm_9[MAX_N_PAIRS]; // L^-1 rk9 of pair i = L^-1 rk9 of pair 0 ^ norm_9[i]
+  u8 norm_8[3][MAX_N_PAIRS];
+  u32 L_inv_norm_8[MAX_N_PAIRS]; // norm_8[.][i] as one word
+  u32 L_inv_d[MAX_N_PAIRS];      // inv_linear_layer(d) of pair i
+  u32 L_inv_d_8[MAX_N_PAIRS];    // inv_linear_layer(d << 8) of pair i
+  u8 norm_7_0[MAX_N_PAIRS];
+  // rk10 of pair i = rk10 of pair 0 ^ rk10_diff[i][(u8) linear_layer(L^-1 rk9 of pair 0)]
+  u32 rk10_diff[MAX_N_PAIRS][256];
+  int prefetch; // STEP3_PREFETCH
+  candidate_sink_t *sink; // CANDIDATES, nullptr if not set
+  struct step3_stats_t *stats; // of omp thread k
+};
+
+struct step3_counters_t{
+  u64 rk8[3];
+  u64 survives_rk8;
+  u64 survives_Dy6;
+  u64 survives_rk7;
+};
+
+// output of step 3 for some range of guesses
+struct step3_result_t{
+  step3_counters_t cnt = {};
+  std::vector<key_candidate_t> candidates;
+};
+
+// funnel of step 3, always on (unlike the COUNTERS): survivors of every
+// stage and, for one block of guesses in STEP3_STATS_SAMPLE, the rdtsc
+// cycles spent in every stage. Every thread has its own cache lines and
+// publishes its counters with every sampled block for the report. The
+// sampled guesses lose some overlap of the memory accesses, so their cycles
+// show where the time goes rather than add up to the average guess
+enum step3_stage_t {
+  STAGE_FRONT = 0,  // x8, x8', delta_z7 and v8 of every pair (step3_front*, step3_front_pair)
+  STAGE_T = 1,      // T lookups (compressed T: rejects empty rows)
+  STAGE_RK8 = 2,    // intersection of the rk8 byte candidates
+  STAGE_RK7 = 3,    // Delta y6 and rk7 filters of every rk8 candidate
+  STAGE_OUTPUT = 4, // candidates to res and CANDIDATES
+};
+const int N_STAGES = 5;
+static const char *STAGE_NAMES[] = {"front", "T lookup", "rk8 filter", "Dy6/rk7 filter", "output"};
+enum step3_count_t {
+  COUNT_GUESSES = 0,
+  COUNT_EMPTY_T = 1, // rejected by an empty T row
+  COUNT_RK8 = 2,  // survived the rk8 filter
+  COUNT_DY6 = 3,  // rk8 candidates that survived the Delta y6 filter of all pairs
+  COUNT_RK7 = 4,  // survived the rk7 filter (= candidates)
+  COUNT_SAMPLED = 5, // guesses with timed stages
+};
+const int N_COUNTS = 6;
+const u64 STEP3_STATS_SAMPLE = 256; // blocks (or guesses for the scalar kernel)
+
+struct alignas(64) step3_stats_t{
+  // written by the owner only, plain memory s.t. the hot loop is not slowed
+  // down by atomics
+  int thread;
+  u64 n_blocks;
+  u64 count[N_COUNTS];
+  u64 cycles[N_STAGES];
+  // copies for the report, updated with every sampled block
+  std::atomic<u64> published_count[N_COUNTS];
+  std::atomic<u64> published_cycles[N_STAGES];
+};
+
+void step3_stats_publish(step3_stats_t &st){
+  for(int c = 0; c < N_COUNTS; c++) st.published_count[c].store(st.count[c], std::memory_order_relaxed);
+  for(int s = 0; s < N_STAGES; s++) st.published_cycles[s].store(st.cycles[s], std::memory_order_relaxed);
+}
+
+// charges the cycles since the last switch to the current stage, nothing
+// is left of it for the guesses that are not sampled (SAMPLE = false)
+template<bool SAMPLE>
+struct step3_stage_timer_t{
+  step3_stats_t &st;
+  int stage;
+  u64 t = 0;
+  step3_stage_timer_t(step3_stats_t &st, int stage) : st(st), stage(stage) {
+    if constexpr (SAMPLE) t = __rdtsc();
+  }
+  void to(int next){
+    if constexpr (SAMPLE){
+      u64 now = __rdtsc();
+      st.cycles[stage] += now - t;
+      t = now;
+    }
+    stage = next;
+  }
+  ~step3_stage_timer_t(){ to(stage); }
+};
+
+void step3_stats_init(step3_stats_t *stats, int n_threads){
+  for(int k = 0; k < n_threads; k++){
+    step3_stats_t &st = stats[k];
+    st.thread = k;
+    st.n_blocks = 0;
+    for(int c = 0; c < N_COUNTS; c++) st.count[c] = 0;
+    for(int s = 0; s < N_STAGES; s++) st.cycles[s] = 0;
+    step3_stats_publish(st);
+  }
+}
+
+// survivors per stage, cycles per stage and guesses per second (since start)
+// of all threads, as of their last sampled block
+void step3_stats_report(const step3_stats_t *stats, int n_threads, nanoseconds elapsed){
+  u64 count[N_COUNTS] = {0}, cycles[N_STAGES] = {0};
+  for(int k = 0; k < n_threads; k++){
+    for(int c = 0; c < N_COUNTS; c++) count[c] += stats[k].published_count[c].load(std::memory_order_relaxed);
+    for(int s = 0; s < N_STAGES; s++) cycles[s] += stats[k].published_cycles[s].load(std::memory_order_relaxed);
+  }
+  const double g = std::max<u64>(count[COUNT_GUESSES], 1), c = std::max<u64>(count[COUNT_SAMPLED], 1);
+  std::cout << "Funnel: " << std::dec << count[COUNT_GUESSES] << " guesses, " << count[COUNT_GUESSES] * 1e9 / std::max<double>(elapsed.count(), 1) << " guesses/s" << std::endl;
+  std::cout << "  survived T lookup: " << 1 - count[COUNT_EMPTY_T] / g << ", rk8 filter: " << count[COUNT_RK8] / g << ", Delta y6 filter: " << count[COUNT_DY6] / g;
+  std::cout << ", rk7 filter: " << count[COUNT_RK7] / g << " (" << count[COUNT_RK7] << ")" << std::endl;
+  std::cout << "  cycles per guess:";
+  for(int s = 0; s < N_STAGES; s++) std::cout << " " << STAGE_NAMES[s] << " " << std::setprecision(3) << cycles[s] / c << (s + 1 < N_STAGES ? "," : "");
+  std::cout << std::setprecision(6) << " (" << count[COUNT_SAMPLED] << " sampled guesses)" << std::endl;
+}
+
+void step3_result_add(step3_result_t &a, const step3_result_t &b){
+  for(int j = 0; j < 3; j++) a.cnt.rk8[j] += b.cnt.rk8[j];
+  a.cnt.survives_rk8 += b.cnt.survives_rk8;
+  a.cnt.survives_Dy6 += b.cnt.survives_Dy6;
+  a.cnt.survives_rk7 += b.cnt.survives_rk7;
+  a.candidates.insert(a.candidates.end(), b.candidates.begin(), b.candidates.end());
+}
+
+// pair i of ctx is PAIRS[pair_order[i]] (nullptr: index order)
+void step3_ctx_init(step3_ctx_t &ctx, const std::vector<pair_t> &PAIRS, const u8 *pair_order){
+  ctx.t_0 = PAIRS[0].t;
+  for(u32 i = 0; i < PAIRS.size(); i++){
+    ctx.pair_order[i] = pair_order ? pair_order[i] : i;
+    const pair_t &pair = ctx.PAIRS[i] = PAIRS[ctx.pair_order[i]];
+    ctx.norm_9[i] = inv_linear_layer(normalize_round_key(0, ctx.t_0 ^ pair.t, 9));
+    u32 norm_8_ = inv_linear_layer(normalize_round_key(0, pair.t, 8));
+    ctx.norm_8[0][i] = (u8) (norm_8_ >> 16);
+    ctx.norm_8[1][i] = (u8) (norm_8_ >> 8);
+    ctx.norm_8[2][i] = (u8) norm_8_;
+    ctx.L_inv_norm_8[i] = norm_8_;
+    ctx.L_inv_d[i] = inv_linear_layer(pair.d);
+    ctx.L_inv_d_8[i] = inv_linear_layer((u32) pair.d << 8);
+    ctx.norm_7_0[i] = (u8) (inv_linear_layer(normalize_round_key(0, pair.t, 7)) >> 16);
+    for(u32 b = 0; b < 256; b++){
+      u8 b_i = b ^ (u8) linear_layer(ctx.norm_9[i]);
+      ctx.rk10_diff[i][b] = normalize_round_key_10(normalize_round_key_10(0, b, ctx.t_0), b_i, pair.t);
+    }
+  }
+}
+
+// (subset_t and the portable simd_u32_t are returned by value, see
+// subset_intersect for -Wpsabi)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+// the fronts compute the first STEP3_EAGER_PAIRS pairs of every guess (with
+// SIMD and prefetching), step3_back computes the later pairs one by one and
+// only while the intersection of the pairs before is not empty. Their T rows
+// are not prefetched, so this only pays off once few guesses get that far
+// (about 6% survive the rk8 filter with 3 pairs)
+const int STEP3_EAGER_PAIRS = 4;
+
+// the part of N guesses (rk10_, L_inv_rk9_ + l) needed by the rk8 filter
+// (lane l, one vector per eager pair and value for the SIMD fronts)
+template<int NP, int N>
+struct step3_front_t{
+  static const int NE = std::min(NP, STEP3_EAGER_PAIRS);
+  alignas(64) u32 x8[NE][N];
+  alignas(64) u32 x8_PRIME[NE][N];
+  alignas(64) u32 delta_z7[NE][N];
+  alignas(64) u32 v8[NE][N]; // L^-1 x8
+};
+
+// compute x8, x8', Delta z7 and v8 of pair i for one guess
+inline void step3_front_pair(const step3_ctx_t &ctx, u32 rk10_, u32 L_inv_rk9_, int i, u32 &x8, u32 &x8_PRIME, u32 &delta_z7, u32 &v8){
+  const pair_t &pair = ctx.PAIRS[i];
+
+  // de-normalise keys
+  const u32 L_inv_rk9 = L_inv_rk9_ ^ ctx.norm_9[i];
+  const u32 rk10 = rk10_ ^ ctx.rk10_diff[i][(u8) linear_layer(L_inv_rk9_)];
+  const u32 rk10_PRIME = rk10 ^ ((u32) pair.d << 16);
+
+  // compute Delta_y7 from c, c', rk9, rk10: with y = inv_linear_layer(x9)
+  // x8 = inv_round_with_MC_inv_key(x9, L_inv_rk9) = inv_sub_bytes(y ^ L_inv_rk9)
+  // and v8 = inv_round_with_MC_L_inv(y, L_inv_rk9)
+  const u32 y = lut32_lookup(LUT_INV_NO_MC_L_INV_32, pair.c ^ rk10);
+  const u32 y_PRIME = lut32_lookup(LUT_INV_NO_MC_L_INV_32, pair.c_prime ^ rk10_PRIME);
+  x8 = inv_sub_bytes(y ^ L_inv_rk9);
+  x8_PRIME = inv_sub_bytes(y_PRIME ^ L_inv_rk9);
+  delta_z7 = x8 ^ x8_PRIME ^ ((u32) pair.d);
+  v8 = inv_round_with_MC_L_inv(y, L_inv_rk9);
+}
+
+// compute x8, x8', Delta z7 and v8 of the eager pairs for one guess
+template<int NP>
+inline void step3_front(const step3_ctx_t &ctx, u32 rk10_, u32 L_inv_rk9_, step3_front_t<NP, 1> &f){
+  for(int i = 0; i < f.NE; i++) step3_front_pair(ctx, rk10_, L_inv_rk9_, i, f.x8[i][0], f.x8_PRIME[i][0], f.delta_z7[i][0], f.v8[i][0]);
+}
+
+// check one guess (rk10_, L_inv_rk9_) given its front (lane l of f), candidates are appended to res.candidates
+// (or pushed to ctx.sink if set), the funnel goes to st (only counted on the rare
+// paths, the caller counts the guesses)
+// NP = N_PAIRS, CNT = COUNTERS and COMPRESSED = COMPRESSED_T are template parameters
+// s.t. all loops over the pairs are unrolled and no flag is checked at run time,
+// SAMPLE: time the stages (see step3_stats_t)
+template<int NP, bool CNT, bool COMPRESSED, bool SAMPLE, int N>
+inline void step3_back(const step3_ctx_t &ctx, u32 rk10_, u32 L_inv_rk9_, const step3_front_t<NP, N> &f, int l, step3_result_t &res, step3_stats_t &st){
+  const pair_t *PAIRS = ctx.PAIRS;
+  step3_counters_t &cnt = res.cnt;
+  step3_stage_timer_t<SAMPLE> timer(st, STAGE_T);
+
+  // front values of pair i (the later pairs computed below)
+  constexpr int NE = step3_front_t<NP, N>::NE;
+  u32 x8_PRIME[NP], v8[NP];
+  for(int i = 0; i < NE; i++){
+    x8_PRIME[i] = f.x8_PRIME[i][l];
+    v8[i] = f.v8[i][l];
+  }
+
+  // eager pairs: all T lookups first s.t. the loads overlap
+  // (a guess with an empty row is counted once, with counters it is not
+  // rejected before the rk8 filter, they need the subset sizes of all pairs)
+  const subset_t *bytes_pair[NE][3];
+  u8 v8_bytes[3][NE];
+  bool empty_row = false;
+  for(int i = 0; i < NE; i++){
+    const u32 delta_z7 = f.delta_z7[i][l];
+    if constexpr (COMPRESSED){
+      // fast rejection without touching index and dictionaries
+      const bool empty = !compressed_T_nonempty(*ctx.CT[i], delta_z7);
+      if constexpr (!CNT) if(empty){ st.count[COUNT_EMPTY_T]++; return; }
+      empty_row |= empty;
+    }
+    for(int j = 0; j < 3; j++){
+      if constexpr (COMPRESSED) bytes_pair[i][j] = compressed_T_lookup(*ctx.CT[i], delta_z7, j);
+      else bytes_pair[i][j] = &ctx.T[i][delta_z7][j];
+      v8_bytes[j][i] = (u8) (v8[i] >> (16 - 8*j));
+    }
+  }
+  // the three bytes of a row are either all empty or all non-empty
+  if constexpr (!COMPRESSED) for(int i = 0; i < NE; i++) empty_row |= subset_is_empty(*bytes_pair[i][0]);
+  if(empty_row){
+    st.count[COUNT_EMPTY_T]++;
+    if constexpr (!CNT) return;
+  }
+  timer.to(STAGE_RK8);
+
+  // intersection[j] of byte j: rk8_j = element ^ base[j]
+  subset_t intersection[3];
+  u8 base[3];
+  for(int j = 0; j < 3; j++){
+    // fast rejection with byte j after every pair
+    base[j] = v8_bytes[j][0] ^ ctx.norm_8[j][0];
+    if constexpr (CNT) cnt.rk8[j] += subset_size(*bytes_pair[0][j]);
+    intersection[j] = *bytes_pair[0][j];
+    for(int i = 1; i < NE; i++){
+      if constexpr (CNT) cnt.rk8[j] += subset_size(*bytes_pair[i][j]);
+      // with counters all three bytes are counted before rejecting
+      if(!subset_intersect_shift(intersection[j], *bytes_pair[i][j], base[j] ^ v8_bytes[j][i] ^ ctx.norm_8[j][i]) && !CNT) return;
+    }
+    if constexpr (!CNT && NE == 1) if(subset_is_empty(intersection[j])) return;
+  }
+
+  // later pairs one by one, only for the guesses that survived the pairs
+  // before (their T rows are not prefetched, too few guesses get here)
+  for(int i = NE; i < NP; i++){
+    timer.to(STAGE_FRONT);
+    u32 x8, delta_z7;
+    step3_front_pair(ctx, rk10_, L_inv_rk9_, i, x8, x8_PRIME[i], delta_z7, v8[i]);
+    timer.to(STAGE_T);
+    bool empty = false;
+    if constexpr (COMPRESSED) empty = !compressed_T_nonempty(*ctx.CT[i], delta_z7);
+    if constexpr (COMPRESSED && !CNT) if(empty){ st.count[COUNT_EMPTY_T]++; return; }
+    const subset_t *bytes[3];
+    for(int j = 0; j < 3; j++){
+      if constexpr (COMPRESSED) bytes[j] = compressed_T_lookup(*ctx.CT[i], delta_z7, j);
+      else bytes[j] = &ctx.T[i][delta_z7][j];
+    }
+    if constexpr (!COMPRESSED) empty = subset_is_empty(*bytes[0]);
+    if(empty && !empty_row){
+      st.count[COUNT_EMPTY_T]++;
+      if constexpr (!CNT) return;
+      empty_row = true;
+    }
+    timer.to(STAGE_RK8);
+    for(int j = 0; j < 3; j++){
+      if constexpr (CNT) cnt.rk8[j] += subset_size(*bytes[j]);
+      if(!subset_intersect_shift(intersection[j], *bytes[j], base[j] ^ (u8) (v8[i] >> (16 - 8*j)) ^ ctx.norm_8[j][i]) && !CNT) return;
+    }
+  }
+  if constexpr (CNT){
+    for(int j = 0; j < 3; j++) if(subset_is_empty(intersection[j])) return;
+    cnt.survives_rk8++;
+  }
+  st.count[COUNT_RK8]++;
+  timer.to(STAGE_RK7);
+
+  for(u8 rk8_0 : subset_get_elements(intersection[0])){
+    rk8_0 ^= base[0];
+    for(u8 rk8_1 : subset_get_elements(intersection[1])){
+      rk8_1 ^= base[1];
+      for(u8 rk8_2 : subset_get_elements(intersection[2])){
+        rk8_2 ^= base[2];
+        const u32 L_inv_rk8 = ((u32) rk8_0 << 16) ^ ((u32) rk8_1 << 8) ^ ((u32) rk8_2);
+        subset_t L_inv_rk7_0;
+        L_inv_rk7_0 = subset_init_full();
+        // with counters every pair is checked and survives_Dy6 counts the
+        // pairs passed in the order of the attack (bit pair_order[i] of
+        // passed), i.e., independent of STEP3_FILTER_ORDER
+        [[maybe_unused]] u32 passed = 0;
+        for(int i = 0; i < NP; i++){
+          // v7 = inv_linear_layer(inv_round_with_MC(x8, rk8 of pair i)) in the
+          // inv_linear_layer domain, x8' with rk8 ^ d and d << 8 added to y7'
+          const u32 L_inv_rk8_normalised = L_inv_rk8 ^ ctx.L_inv_norm_8[i];
+          u32 v7 = inv_round_with_MC_L_inv(v8[i], L_inv_rk8_normalised);
+          u32 v7_PRIME = inv_round_with_MC_L_inv(inv_linear_layer(x8_PRIME[i]), L_inv_rk8_normalised ^ ctx.L_inv_d[i]) ^ ctx.L_inv_d_8[i];
+          if(((v7 ^ v7_PRIME) & 0x00FFFF) != 0){
+            if constexpr (CNT) continue;
+            goto next_rk_8;
+          }
+          if constexpr (CNT) passed |= 1u << ctx.pair_order[i];
+          u8 delta_v7_0 = (u8) ((v7 ^ v7_PRIME) >> 16);
+          u8 v7_0 = (u8) (v7 >> 16);
+          L_inv_rk7_0 = subset_intersect(L_inv_rk7_0, ctx.DDTV_out_shifted[PAIRS[i].d][delta_v7_0][v7_0 ^ ctx.norm_7_0[i]]);
+        }
+        if constexpr (CNT){
+          cnt.survives_Dy6 += __builtin_ctz(~passed);
+          if(passed != (1u << NP) - 1) goto next_rk_8;
+        }
+        st.count[COUNT_DY6]++;
+        for(u8 L_inv_rk7_0_ : subset_get_elements(L_inv_rk7_0)){
+          if constexpr (CNT) cnt.survives_rk7++;
+          st.count[COUNT_RK7]++;
+          timer.to(STAGE_OUTPUT);
+          key_candidate_t cand = {L_inv_rk7_0_, linear_layer(L_inv_rk8), normalize_round_key(linear_layer(L_inv_rk9_), ctx.t_0, 9),
+                                  normalize_round_key_10(rk10_, (u8) linear_layer(L_inv_rk9_), ctx.t_0)};
+          if(ctx.sink){
+            candidate_record_t r = {cand.rk8, cand.rk9, cand.rk10, rk10_, L_inv_rk9_, cand.L_inv_rk7_0, {0, 0, 0}};
+            candidate_sink_push(*ctx.sink, st.thread, r);
+          } else {
+            res.candidates.push_back(cand);
+          }
+          timer.to(STAGE_RK7);
+        }
+      next_rk_8:;
+      }
+    }
+  }
+}
+
+// SIMD front: SIMD_LANES consecutive guesses L_inv_rk9_ (same rk10_) are evaluated
+// in the lanes of a vector with gathers from the u32 LUTs (see lut32_t)
+#if defined(__AVX512F__)
+typedef __m512i simd_u32_t;
+const int SIMD_LANES = 16;
+static inline simd_u32_t simd_set1(u32 a){ return _mm512_set1_epi32(a); }
+static inline simd_u32_t simd_xor(simd_u32_t a, simd_u32_t b){ return _mm512_xor_si512(a, b); }
+static inline simd_u32_t simd_byte(simd_u32_t a, int j){ return _mm512_and_si512(_mm512_maskz_srli_epi32(0xFFFF, a, 16 - 8*j), _mm512_set1_epi32(0xFF)); }
+static inline simd_u32_t simd_gather(const u32 *table, simd_u32_t index){ return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), 0xFFFF, index, table, 4); }
+static inline simd_u32_t simd_lane_index(){ return _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+static inline void simd_store(u32 *p, simd_u32_t a){ _mm512_storeu_si512(p, a); }
+#elif defined(__AVX2__)
+typedef __m256i simd_u32_t;
+const int SIMD_LANES = 8;
+static inline simd_u32_t simd_set1(u32 a){ return _mm256_set1_epi32(a); }
+static inline simd_u32_t simd_xor(simd_u32_t a, simd_u32_t b){ return _mm256_xor_si256(a, b); }
+static inline simd_u32_t simd_byte(simd_u32_t a, int j){ return _mm256_and_si256(_mm256_srli_epi32(a, 16 - 8*j), _mm256_set1_epi32(0xFF)); }
+static inline simd_u32_t simd_gather(const u32 *table, simd_u32_t index){ return _mm256_i32gather_epi32((const int *) table, index, 4); }
+static inline simd_u32_t simd_lane_index(){ return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+static inline void simd_store(u32 *p, simd_u32_t a){ _mm256_storeu_si256((__m256i *) p, a); }
+#else
+// portable build (STEP3_ISA_DISPATCH): plain vectors, lowered to SSE2 (the
+// front is compiled once, only the subset operations are picked at startup)
+typedef u32 simd_u32_t __attribute__((vector_size(32)));
+const int SIMD_LANES = 8;
+inline simd_u32_t simd_set1(u32 a){ return a - simd_u32_t{0}; }
+inline simd_u32_t simd_xor(const simd_u32_t &a, const simd_u32_t &b){ return a ^ b; }
+inline simd_u32_t simd_byte(const simd_u32_t &a, int j){ return (a >> (16 - 8*j)) & 0xFF; }
+inline simd_u32_t simd_gather(const u32 *table, const simd_u32_t &index){
+  simd_u32_t r;
+  for(int k = 0; k < SIMD_LANES; k++) r[k] = table[index[k]];
+  return r;
+}
+inline simd_u32_t simd_lane_index(){ return simd_u32_t{0, 1, 2, 3, 4, 5, 6, 7}; }
+inline void simd_store(u32 *p, const simd_u32_t &a){ memcpy(p, &a, sizeof(a)); }
+#endif
+
+// XOR of one lookup per byte of the 24 bit states in a (always inlined, an
+// out-of-line copy of the portable build gets -Wpsabi without a location)
+inline __attribute__((always_inline)) simd_u32_t simd_lookup(const lut32_t &LUT, const simd_u32_t &a){
+  return simd_xor(simd_xor(simd_gather(LUT[0].data(), simd_byte(a, 0)), simd_gather(LUT[1].data(), simd_byte(a, 1))), simd_gather(LUT[2].data(), simd_byte(a, 2)));
+}
+
+// rest of the SIMD front given a = inv_linear_layer(x9) ^ L_inv_rk9 (and a' for x9')
+// of every eager pair, i.e., x8 = inv_sub_bytes(a)
+template<int NP>
+inline void step3_front_simd_finish(const step3_ctx_t &ctx, const simd_u32_t *a, const simd_u32_t *a_PRIME, step3_front_t<NP, SIMD_LANES> &f){
+  for(int i = 0; i < f.NE; i++){
+    simd_u32_t x8 = simd_lookup(LUT_INV_SBOX_32, a[i]);
+    simd_u32_t x8_PRIME = simd_lookup(LUT_INV_SBOX_32, a_PRIME[i]);
+    simd_store(f.x8[i], x8);
+    simd_store(f.x8_PRIME[i], x8_PRIME);
+    simd_store(f.delta_z7[i], simd_xor(simd_xor(x8, x8_PRIME), simd_set1(ctx.PAIRS[i].d)));
+    simd_store(f.v8[i], simd_lookup(LUT_INV_SBOX_L_INV_32, a[i]));
+  }
+}
+
+// step3_front for the guesses L_inv_rk9_, ..., L_inv_rk9_ + SIMD_LANES - 1
+template<int NP>
+inline void step3_front_simd(const step3_ctx_t &ctx, u32 rk10_, u32 L_inv_rk9_, step3_front_t<NP, SIMD_LANES> &f){
+  const pair_t *PAIRS = ctx.PAIRS;
+  const simd_u32_t w = simd_xor(simd_set1(L_inv_rk9_), simd_lane_index());
+  // (u8) linear_layer(L_inv_rk9[0]), the only byte of rk9 rk10[i] depends on
+  const simd_u32_t b = simd_byte(simd_lookup(LUT_L_32, w), 2);
+
+  simd_u32_t a[NP], a_PRIME[NP];
+  for(int i = 0; i < f.NE; i++){
+    const simd_u32_t L_inv_rk9 = simd_xor(w, simd_set1(ctx.norm_9[i]));
+    const simd_u32_t rk10 = simd_xor(simd_set1(rk10_), simd_gather(ctx.rk10_diff[i], b));
+    const simd_u32_t rk10_PRIME = simd_xor(rk10, simd_set1((u32) PAIRS[i].d << 16));
+    // inv_round_with_MC_inv_key(inv_round_no_MC(c, rk10), L_inv_rk9) = inv_sub_bytes(a)
+    a[i] = simd_xor(simd_lookup(LUT_INV_NO_MC_L_INV_32, simd_xor(simd_set1(PAIRS[i].c), rk10)), L_inv_rk9);
+    a_PRIME[i] = simd_xor(simd_lookup(LUT_INV_NO_MC_L_INV_32, simd_xor(simd_set1(PAIRS[i].c_prime), rk10_PRIME)), L_inv_rk9);
+  }
+  step3_front_simd_finish<NP>(ctx, a, a_PRIME, f);
+}
+
+// memo of the part of the front that depends on the guess L_inv_rk9_ only
+// through b = (u8) linear_layer(L_inv_rk9_) (i.e., through rk10 of pair i),
+// computed once per rk10_ for all 256 values of b (eager pairs only)
+template<int NP>
+struct step3_memo_t{
+  static const int NE = step3_front_t<NP, SIMD_LANES>::NE;
+  alignas(64) u32 y[NE][256];       // inv_linear_layer(inv_round_no_MC(c, rk10))
+  alignas(64) u32 y_PRIME[NE][256]; // inv_linear_layer(inv_round_no_MC(c', rk10'))
+};
+
+template<int NP>
+void step3_memo_init(const step3_ctx_t &ctx, u32 rk10_, step3_memo_t<NP> &memo){
+  for(int i = 0; i < memo.NE; i++){
+    for(u32 b = 0; b < 256; b++){
+      u32 rk10 = rk10_ ^ ctx.rk10_diff[i][b];
+      memo.y[i][b] = inv_linear_layer(inv_round_no_MC(ctx.PAIRS[i].c, rk10));
+      memo.y_PRIME[i][b] = inv_linear_layer(inv_round_no_MC(ctx.PAIRS[i].c_prime, rk10 ^ ((u32) ctx.PAIRS[i].d << 16)));
+    }
+  }
+}
+
+// step3_front_simd with the memo, L_inv_rk9_ is aligned to SIMD_LANES and b = (u8) linear_layer(L_inv_rk9_)
+// L_lanes = (u8) linear_layer(lane index)
+template<int NP>
+inline void step3_front_memo(const step3_ctx_t &ctx, const step3_memo_t<NP> &memo, u32 L_inv_rk9_, u8 b, const simd_u32_t &L_lanes, step3_front_t<NP, SIMD_LANES> &f){
+  const simd_u32_t w = simd_xor(simd_set1(L_inv_rk9_), simd_lane_index());
+  // linear_layer is linear and the lane index is XORed
+  const simd_u32_t b_lanes = simd_xor(simd_set1(b), L_lanes);
+
+  simd_u32_t a[NP], a_PRIME[NP];
+  for(int i = 0; i < f.NE; i++){
+    const simd_u32_t L_inv_rk9 = simd_xor(w, simd_set1(ctx.norm_9[i]));
+    a[i] = simd_xor(simd_gather(memo.y[i], b_lanes), L_inv_rk9);
+    a_PRIME[i] = simd_xor(simd_gather(memo.y_PRIME[i], b_lanes), L_inv_rk9);
+  }
+  step3_front_simd_finish<NP>(ctx, a, a_PRIME, f);
+}
+
+// evaluation of the guesses in step3_tile, see STEP3_KERNEL
+enum step3_kernel_t {
+  STEP3_SCALAR = 0, // one guess after the other
+  STEP3_SIMD = 1,   // front of SIMD_LANES guesses at once (step3_front_simd)
+  STEP3_MEMO = 2,   // step3_front_memo with the blocks of SIMD_LANES guesses in Gray code order
+};
+static const char *STEP3_KERNEL_NAMES[] = {"scalar", "simd", "memo"};
+const int N_STEP3_KERNELS = 3;
+
+int step3_kernel_from_name(const std::string &name){
+  for(int k = 0; k < N_STEP3_KERNELS; k++) if(name == STEP3_KERNEL_NAMES[k]) return k;
+  return -1;
+}
+
+// software pipeline for the blocks of SIMD_LANES guesses of the simd and memo
+// kernels: the front of a block is computed `depth` blocks before its back,
+// meanwhile the T rows of the block (eager pairs) are prefetched s.t. the back of the
+// current block overlaps with the memory accesses of the following ones
+// (the blocks are checked in the order they are pushed). Every block
+// belongs to one of the targets ctx[t] (with result res[t]), the blocks of
+// several targets are interleaved s.t. their T lookups overlap as well
+template<int NP, bool CNT, bool COMPRESSED>
+struct step3_pipeline_t{
+  static const int SLOTS = STEP3_MAX_PREFETCH + 1;
+  const step3_ctx_t *ctx;
+  step3_result_t *res;
+  step3_stats_t &st;
+  int depth;
+  u64 n = 0; // number of pushed blocks
+  int target[SLOTS];
+  u32 rk10_[SLOTS], L_inv_rk9_[SLOTS];
+  bool sampled[SLOTS]; // time the stages of the block (see step3_stats_t)
+  step3_front_t<NP, SIMD_LANES> f[SLOTS];
+
+  step3_pipeline_t(const step3_ctx_t *ctx, step3_result_t *res, step3_stats_t &st, int depth) : ctx(ctx), res(res), st(st), depth(depth) {}
+
+  // fill in the front of the next block, then push it
+  step3_front_t<NP, SIMD_LANES> &next(){ return f[n % SLOTS]; }
+
+  void push(int t, u32 rk10, u32 L_inv_rk9, bool sample){
+    const int s = n % SLOTS;
+    target[s] = t;
+    rk10_[s] = rk10;
+    L_inv_rk9_[s] = L_inv_rk9;
+    sampled[s] = sample;
+    if(depth > 0){
+      prefetch_rows(ctx[t], f[s]);
+      // compressed T: the dictionary entries can only be prefetched when the
+      // index (prefetched by prefetch_rows) has arrived, half way to the back
+      if constexpr (COMPRESSED) if(n >= (u64) depth / 2){
+        const int s_dict = (n - depth / 2) % SLOTS;
+        prefetch_dict(ctx[target[s_dict]], f[s_dict]);
+      }
+    }
+    n++;
+    if(n > (u64) depth) back(n - 1 - depth);
+  }
+
+  // check the remaining blocks
+  void flush(){
+    for(u64 k = n - std::min(n, (u64) depth); k < n; k++) back(k);
+    n = 0;
+  }
+
+  void back(u64 k){
+    const int s = k % SLOTS;
+    if(sampled[s]){
+      back_<true>(s);
+      st.count[COUNT_SAMPLED] += SIMD_LANES;
+    } else {
+      back_<false>(s);
+    }
+  }
+
+  template<bool SAMPLE>
+  void back_(int s){
+    const int t = target[s];
+    for(int l = 0; l < SIMD_LANES; l++) step3_back<NP, CNT, COMPRESSED, SAMPLE>(ctx[t], rk10_[s], L_inv_rk9_[s] + l, f[s], l, res[t], st);
+    st.count[COUNT_GUESSES] += SIMD_LANES;
+  }
+
+  void prefetch_rows(const step3_ctx_t &ctx, const step3_front_t<NP, SIMD_LANES> &f){
+    for(int i = 0; i < f.NE; i++){
+      for(int l = 0; l < SIMD_LANES; l++){
+        const u32 delta_z7 = f.delta_z7[i][l];
+        // the entry may span two cache lines
+        if constexpr (COMPRESSED){
+          const u8 *p = ctx.CT[i]->index + 9*delta_z7;
+          _mm_prefetch((const char *) p, _MM_HINT_T0);
+          _mm_prefetch((const char *) p + 8, _MM_HINT_T0);
+        } else {
+          const char *p = (const char *) &ctx.T[i][delta_z7][0];
+          _mm_prefetch(p, _MM_HINT_T0);
+          _mm_prefetch(p + 3*sizeof(subset_t) - 1, _MM_HINT_T0);
+        }
+      }
+    }
+  }
+
+  void prefetch_dict(const step3_ctx_t &ctx, const step3_front_t<NP, SIMD_LANES> &f){
+    for(int i = 0; i < f.NE; i++){
+      for(int l = 0; l < SIMD_LANES; l++){
+        for(int j = 0; j < 3; j++) _mm_prefetch((const char *) compressed_T_lookup(*ctx.CT[i], f.delta_z7[i][l], j), _MM_HINT_T0);
+      }
+    }
+  }
+};
+
+// time the stages of every STEP3_STATS_SAMPLE-th block (or scalar guess)
+// (the counters of the earlier blocks are published then)
+inline bool step3_sample(step3_stats_t &st){
+  if(st.n_blocks++ % STEP3_STATS_SAMPLE != 0) return false;
+  step3_stats_publish(st);
+  return true;
+}
+
+// one guess with the scalar front
+template<int NP, bool CNT, bool COMPRESSED>
+inline void step3_guess(const step3_ctx_t &ctx, u32 rk10_, u32 L_inv_rk9_, step3_front_t<NP, 1> &f1, step3_result_t &res, step3_stats_t &st){
+  const bool sample = step3_sample(st);
+  const u64 t = sample ? __rdtsc() : 0;
+  step3_front<NP>(ctx, rk10_, L_inv_rk9_, f1);
+  if(sample){
+    st.cycles[STAGE_FRONT] += __rdtsc() - t;
+    step3_back<NP, CNT, COMPRESSED, true>(ctx, rk10_, L_inv_rk9_, f1, 0, res, st);
+    st.count[COUNT_SAMPLED]++;
+  } else {
+    step3_back<NP, CNT, COMPRESSED, false>(ctx, rk10_, L_inv_rk9_, f1, 0, res, st);
+  }
+  st.count[COUNT_GUESSES]++;
+}
+
+// check all guesses rk10_begin <= rk10_ < rk10_end, rk9_begin <= L_inv_rk9_ < rk9_end (serially)
+// for the targets ctx[0], ..., ctx[n_targets - 1], the candidates of target t go to res[t]
+// (the loops over the guesses are shared, every block of guesses is checked for all targets)
+template<int NP, bool CNT, bool COMPRESSED, int KERNEL>
+void step3_tile(const step3_ctx_t *ctx, int n_targets, u32 rk10_begin, u32 rk10_end, u32 rk9_begin, u32 rk9_end, step3_result_t *res){
+  step3_stats_t &st = ctx[0].stats[omp_get_thread_num()];
+  step3_front_t<NP, 1> f1;
+  step3_pipeline_t<NP, CNT, COMPRESSED> pipeline(ctx, res, st, ctx[0].prefetch);
+  const simd_u32_t L_lanes = simd_byte(simd_lookup(LUT_L_32, simd_lane_index()), 2);
+  std::vector<step3_memo_t<NP>> memo(KERNEL == STEP3_MEMO ? n_targets : 0);
+  for(u32 rk10_ = rk10_begin; rk10_ < rk10_end; rk10_++){ // normalised keys
+    u32 L_inv_rk9_ = rk9_begin;
+    if constexpr (KERNEL != STEP3_SCALAR){
+      // SIMD_LANES aligned blocks, the lanes are the low bits of L_inv_rk9_
+      for(; L_inv_rk9_ % SIMD_LANES != 0 && L_inv_rk9_ < rk9_end; L_inv_rk9_++){
+        for(int t = 0; t < n_targets; t++) step3_guess<NP, CNT, COMPRESSED>(ctx[t], rk10_, L_inv_rk9_, f1, res[t], st);
+      }
+    }
+    if constexpr (KERNEL == STEP3_SIMD){
+      for(; L_inv_rk9_ + SIMD_LANES <= rk9_end; L_inv_rk9_ += SIMD_LANES){
+        for(int t = 0; t < n_targets; t++){
+          const bool sample = step3_sample(st);
+          const u64 c = sample ? __rdtsc() : 0;
+          step3_front_simd<NP>(ctx[t], rk10_, L_inv_rk9_, pipeline.next());
+          if(sample) st.cycles[STAGE_FRONT] += __rdtsc() - c;
+          pipeline.push(t, rk10_, L_inv_rk9_, sample);
+        }
+      }
+      pipeline.flush();
+    }
+    if constexpr (KERNEL == STEP3_MEMO){
+      for(int t = 0; t < n_targets; t++) step3_memo_init<NP>(ctx[t], rk10_, memo[t]);
+      while(L_inv_rk9_ + SIMD_LANES <= rk9_end){
+        // largest aligned chunk of 2**m blocks starting at L_inv_rk9_
+        u32 size = L_inv_rk9_ ? (L_inv_rk9_ & -L_inv_rk9_) : (1 << 24);
+        while(L_inv_rk9_ + size > rk9_end) size >>= 1;
+        // walk the blocks of the chunk in Gray code order s.t. the guess
+        // and b = (u8) linear_layer(guess) change by one XOR per block
+        u32 w = L_inv_rk9_;
+        u8 b = (u8) linear_layer(w);
+        for(u32 k = 0; k < size / SIMD_LANES; k++){
+          if(k != 0){
+            u32 flip = SIMD_LANES << __builtin_ctz(k);
+            w ^= flip;
+            b ^= (u8) linear_layer(flip);
+          }
+          for(int t = 0; t < n_targets; t++){
+            const bool sample = step3_sample(st);
+            const u64 c = sample ? __rdtsc() : 0;
+            step3_front_memo<NP>(ctx[t], memo[t], w, b, L_lanes, pipeline.next());
+            if(sample) st.cycles[STAGE_FRONT] += __rdtsc() - c;
+            pipeline.push(t, rk10_, w, sample);
+          }
+        }
+        L_inv_rk9_ += size;
+      }
+      pipeline.flush();
+    }
+    for(; L_inv_rk9_ < rk9_end; L_inv_rk9_++){
+      for(int t = 0; t < n_targets; t++) step3_guess<NP, CNT, COMPRESSED>(ctx[t], rk10_, L_inv_rk9_, f1, res[t], st);
+    }
+  }
+  step3_stats_publish(st);
+}
+#pragma GCC diagnostic pop
+
+typedef void (*step3_tile_t)(const step3_ctx_t *, int, u32, u32, u32, u32, step3_result_t *);
+
+template<int NP, int KERNEL>
+step3_tile_t select_step3_tile_(bool counters, bool compressed){
+  if(counters) return compressed ? step3_tile<NP, true, true, KERNEL> : step3_tile<NP, true, false, KERNEL>;
+  return compressed ? step3_tile<NP, false, true, KERNEL> : step3_tile<NP, false, false, KERNEL>;
+}
+
+template<int NP>
+step3_tile_t select_step3_tile_(bool counters, bool compressed, int kernel){
+  static_assert(N_STEP3_KERNELS == 3, "add the missing cases below");
+  switch(kernel){
+  case STEP3_SCALAR: return select_step3_tile_<NP, STEP3_SCALAR>(counters, compressed);
+  case STEP3_SIMD: return select_step3_tile_<NP, STEP3_SIMD>(counters, compressed);
+  case STEP3_MEMO: return select_step3_tile_<NP, STEP3_MEMO>(counters, compressed);
+  default: return nullptr;
+  }
+}
+
+// pick the specialization of step3_tile for the run time configuration
+step3_tile_t select_step3_tile(u32 n_pairs, bool counters, bool compressed, int kernel){
+  static_assert(MAX_N_PAIRS == 8, "add the missing cases below");
+  switch(n_pairs){
+  case 1: return select_step3_tile_<1>(counters, compressed, kernel);
+  case 2: return select_step3_tile_<2>(counters, compressed, kernel);
+  case 3: return select_step3_tile_<3>(counters, compressed, kernel);
+  case 4: return select_step3_tile_<4>(counters, compressed, kernel);
+  case 5: return select_step3_tile_<5>(counters, compressed, kernel);
+  case 6: return select_step3_tile_<6>(counters, compressed, kernel);
+  case 7: return select_step3_tile_<7>(counters, compressed, kernel);
+  case 8: return select_step3_tile_<8>(counters, compressed, kernel);
+  default: return nullptr;
+  }
+}
+
+// key and pairs of one attack, see DATA
+const u64 DATA_MAGIC = 0x31415441444c4648; // "HFLDATA1"
+const u32 DATA_VERSION = 1;
+
+struct data_header_t{
+  u64 magic;
+  u32 version;
+  u32 n_pairs;
+  u128 key;
+};
+
+bool same_pairs(const pair_t *a, const pair_t *b, u32 n_pairs){
+  for(u32 i = 0; i < n_pairs; i++){
+    if(a[i].p != b[i].p || a[i].t != b[i].t || a[i].d != b[i].d || a[i].c != b[i].c || a[i].c_prime != b[i].c_prime) return false;
+  }
+  return true;
+}
+
+bool data_write(const std::string &path, u128 key, const std::vector<pair_t> &PAIRS){
+  data_header_t h = {DATA_MAGIC, DATA_VERSION, (u32) PAIRS.size(), key};
+  return write_file_atomic(path, {{&h, sizeof(h)}, {PAIRS.data(), PAIRS.size() * sizeof(pair_t)}});
+}
+
+// PAIRS.size() is the expected number of pairs
+bool data_read(const std::string &path, u128 &key, std::vector<pair_t> &PAIRS){
+  std::vector<u8> buf;
+  if(!read_file(path, buf)) return false;
+  data_header_t h;
+  if(buf.size() < sizeof(h) || (memcpy(&h, buf.data(), sizeof(h)), h.magic != DATA_MAGIC) || h.version != DATA_VERSION ||
+     h.n_pairs != PAIRS.size() || buf.size() != sizeof(h) + h.n_pairs * sizeof(pair_t)){
+    std::cout << "Invalid data " << path << " (wrong N_PAIRS?)" << std::endl;
+    return false;
+  }
+  key = h.key;
+  memcpy(PAIRS.data(), buf.data() + sizeof(h), h.n_pairs * sizeof(pair_t));
+  return true;
+}
+
+// the candidates of a CANDIDATES file in either format (for step 4), the
+// rows that a resumed run reported again are only kept once
+bool candidates_read(const std::string &path, const std::string &format, const std::vector<pair_t> &PAIRS,
+                     std::vector<key_candidate_t> &candidates){
+  std::vector<u8> buf;
+  if(!read_file(path, buf)) return false;
+  const u64 n_before = candidates.size();
+  if(format == "jsonl"){
+    const char *p = (const char *) buf.data();
+    const char *end = p + buf.size();
+    while(p < end){
+      const char *eol = (const char *) memchr(p, '\n', end - p);
+      if(!eol) eol = end;
+      const std::string line(p, eol);
+      unsigned int L_inv_rk7_0, rk8, rk9, rk10;
+      if(sscanf(line.c_str(), "{\"L_inv_rk7_0\":%u,\"rk8\":%u,\"rk9\":%u,\"rk10\":%u,", &L_inv_rk7_0, &rk8, &rk9, &rk10) != 4){
+        std::cout << "Invalid candidates " << path << std::endl;
+        return false;
+      }
+      candidates.push_back({(u8) L_inv_rk7_0, rk8, rk9, rk10});
+      p = eol + 1;
+    }
+  } else {
+    candidate_file_header_t h;
+    std::vector<pair_t> saved_pairs(PAIRS.size());
+    const u64 pairs_size = PAIRS.size() * sizeof(pair_t);
+    bool ok = buf.size() >= sizeof(h) + pairs_size;
+    if(ok){
+      memcpy(&h, buf.data(), sizeof(h));
+      memcpy(saved_pairs.data(), buf.data() + sizeof(h), pairs_size);
+    }
+    if(!ok || h.magic != CANDIDATES_MAGIC || h.version != CANDIDATES_VERSION || h.n_pairs != PAIRS.size() ||
+       (buf.size() - sizeof(h) - pairs_size) % sizeof(candidate_record_t) != 0 ||
+       !same_pairs(PAIRS.data(), saved_pairs.data(), PAIRS.size())){
+      std::cout << "Candidates " << path << " do not match DATA" << std::endl;
+      return false;
+    }
+    for(u64 k = sizeof(h) + pairs_size; k < buf.size(); k += sizeof(candidate_record_t)){
+      candidate_record_t r;
+      memcpy(&r, buf.data() + k, sizeof(r));
+      candidates.push_back({r.L_inv_rk7_0, r.rk8, r.rk9, r.rk10});
+    }
+  }
+  auto key = [](const key_candidate_t &c){ return std::make_tuple(c.L_inv_rk7_0, c.rk8, c.rk9, c.rk10); };
+  std::sort(candidates.begin() + n_before, candidates.end(), [&](const key_candidate_t &a, const key_candidate_t &b){ return key(a) < key(b); });
+  candidates.erase(std::unique(candidates.begin() + n_before, candidates.end(), [&](const key_candidate_t &a, const key_candidate_t &b){ return key(a) == key(b); }),
+                   candidates.end());
+  return true;
+}
+
+// step 3 progress of one shard, the unit of work is one row, i.e., one rk10_
+// with all L_inv_rk9_ (2**24 guesses for the real attack)
+struct step3_state_t{
+  u32 rk10_begin, rk10_end;
+  u32 rk9_begin, rk9_end;
+  std::vector<u64> done; // bit r is set if row rk10_ = rk10_begin + r is finished
+  u64 n_done = 0;
+  step3_result_t res; // of the finished rows
+  u64 candidates_length = 0; // of CANDIDATES, covers the candidates of the finished rows
+};
+
+void step3_state_init(step3_state_t &state, u32 rk10_begin, u32 rk10_end, u32 rk9_begin, u32 rk9_end){
+  state = step3_state_t();
+  state.rk10_begin = rk10_begin;
+  state.rk10_end = rk10_end;
+  state.rk9_begin = rk9_begin;
+  state.rk9_end = rk9_end;
+  state.done.assign((rk10_end - rk10_begin + 63) / 64, 0);
+}
+
+inline bool step3_state_is_done(const std::vector<u64> &done, u32 r){
+  return (done[r / 64] >> (r % 64)) & 1;
+}
+
+// step 3 is split into tiles of one rk10_ and (at most) STEP3_TILE_RK9
+// values of L_inv_rk9_, aligned to STEP3_TILE_RK9 s.t. the memo kernel
+// walks whole chunks. Tile t is tile t % tiles_per_row of row t / tiles_per_row
+const u32 STEP3_TILE_RK9 = 1 << 20;
+
+// work stealing over the tiles of the rows that are not done: every thread
+// starts with an equal contiguous share of the tiles and takes them from the
+// front, a thread whose share is empty steals the back half of the largest
+// share left. The lock of a share is only taken once per tile (and at most
+// one lock is held at a time), nothing is shared while a tile is checked
+struct step3_scheduler_t{
+  struct alignas(64) share_t{
+    std::mutex lock;
+    u64 begin, end; // tiles [begin, end)
+  };
+  std::unique_ptr<share_t[]> share;
+  int n_threads;
+  u32 rk10_begin, rk9_begin, rk9_end;
+  u32 tiles_per_row;
+  const std::vector<u64> *done; // rows to skip (see step3_state_t)
+};
+
+void step3_scheduler_init(step3_scheduler_t &sched, int n_threads, u32 rk10_begin, u32 rk10_end, u32 rk9_begin, u32 rk9_end, const std::vector<u64> *done){
+  sched.share.reset(new step3_scheduler_t::share_t[n_threads]);
+  sched.n_threads = n_threads;
+  sched.rk10_begin = rk10_begin;
+  sched.rk9_begin = rk9_begin;
+  sched.rk9_end = rk9_end;
+  sched.tiles_per_row = (rk9_end - 1) / STEP3_TILE_RK9 - rk9_begin / STEP3_TILE_RK9 + 1;
+  sched.done = done;
+  const u64 n_tiles = (u64) (rk10_end - rk10_begin) * sched.tiles_per_row;
+  for(int k = 0; k < n_threads; k++){
+    sched.share[k].begin = n_tiles * k / n_threads;
+    sched.share[k].end = n_tiles * (k + 1) / n_threads;
+  }
+}
+
+// rk10_ and the range of L_inv_rk9_ of tile t
+void step3_scheduler_tile(const step3_scheduler_t &sched, u64 t, u32 &rk10_, u32 &rk9_begin, u32 &rk9_end){
+  rk10_ = sched.rk10_begin + t / sched.tiles_per_row;
+  const u32 k = sched.rk9_begin / STEP3_TILE_RK9 + t % sched.tiles_per_row;
+  rk9_begin = std::max(sched.rk9_begin, k * STEP3_TILE_RK9);
+  rk9_end = std::min<u64>(sched.rk9_end, (u64) (k + 1) * STEP3_TILE_RK9);
+}
+
+// next tile t of thread k (its own or stolen), false if no tile is left
+bool step3_scheduler_next(step3_scheduler_t &sched, int k, u64 &t){
+  auto row_done = [&](u64 t){
+    return sched.done != nullptr && step3_state_is_done(*sched.done, t / sched.tiles_per_row);
+  };
+  step3_scheduler_t::share_t &own = sched.share[k];
+  while(true){
+    {
+      std::lock_guard<std::mutex> guard(own.lock);
+      while(own.begin < own.end && row_done(own.begin)) own.begin++;
+      if(own.begin < own.end){
+        t = own.begin++;
+        return true;
+      }
+    }
+    int victim = -1;
+    u64 most = 0;
+    for(int v = 0; v < sched.n_threads; v++){
+      if(v == k) continue;
+      std::lock_guard<std::mutex> guard(sched.share[v].lock);
+      if(sched.share[v].end - sched.share[v].begin > most){
+        most = sched.share[v].end - sched.share[v].begin;
+        victim = v;
+      }
+    }
+    if(victim < 0) return false;
+    u64 begin, end;
+    {
+      std::lock_guard<std::mutex> guard(sched.share[victim].lock);
+      step3_scheduler_t::share_t &v = sched.share[victim];
+      // it may have shrunk in the meantime
+      if(v.begin == v.end) continue;
+      end = v.end;
+      begin = v.end - (v.end - v.begin + 1) / 2;
+      v.end = begin;
+    }
+    std::lock_guard<std::mutex> guard(own.lock);
+    own.begin = begin;
+    own.end = end;
+  }
+}
+
+// progress of step 3, reported from its own thread every STATS_INTERVAL
+// seconds: finished tiles, guesses per second and the ETA (at the rate of
+// this run), followed by the funnel. The workers add to tiles_done and
+// guesses_done once per tile
+struct step3_progress_t{
+  u64 n_tiles;
+  u64 n_guesses; // of the n_tiles tiles
+  std::atomic<u64> tiles_done;
+  std::atomic<u64> guesses_done;
+  std::atomic<bool> stop;
+  const step3_stats_t *stats;
+  int n_threads;
+  steady_clock::time_point start;
+  std::thread reporter;
+};
+
+void step3_progress_report(const step3_progress_t &p){
+  const u64 tiles = p.tiles_done.load(std::memory_order_relaxed);
+  const u64 guesses = p.guesses_done.load(std::memory_order_relaxed);
+  const double elapsed = duration_cast<duration<double>>(steady_clock::now() - p.start).count();
+  const double rate = guesses / std::max(elapsed, 1e-9);
+  std::cout << "Progress: " << std::dec << tiles << " of " << p.n_tiles << " tiles (" << std::setprecision(3) << 100.0 * tiles / std::max<u64>(p.n_tiles, 1) << "%), ";
+  std::cout << rate << std::setprecision(6) << " guesses/s, ETA ";
+  if(guesses == 0){
+    std::cout << "unknown" << std::endl;
+  } else {
+    u64 eta = (p.n_guesses - guesses) / rate;
+    std::cout << eta / 86400 << "d " << std::setfill('0') << std::setw(2) << eta / 3600 % 24 << ":" << std::setw(2) << eta / 60 % 60 << ":" << std::setw(2) << eta % 60 << std::setfill(' ') << std::endl;
+  }
+  step3_stats_report(p.stats, p.n_threads, steady_clock::now() - p.start);
+}
+
+void step3_progress_reporter(step3_progress_t *p){
+  auto last = steady_clock::now();
+  while(!p->stop.load()){
+    std::this_thread::sleep_for(100ms);
+    if(steady_clock::now() - last < seconds(CONFIG.stats_interval)) continue;
+    step3_progress_report(*p);
+    last = steady_clock::now();
+  }
+}
+
+void step3_progress_start(step3_progress_t &p, u64 n_tiles, u64 n_guesses, const step3_stats_t *stats, int n_threads, steady_clock::time_point start){
+  p.n_tiles = n_tiles;
+  p.n_guesses = n_guesses;
+  p.tiles_done = 0;
+  p.guesses_done = 0;
+  p.stop = false;
+  p.stats = stats;
+  p.n_threads = n_threads;
+  p.start = start;
+  p.reporter = std::thread(step3_progress_reporter, &p);
+}
+
+void step3_progress_stop(step3_progress_t &p){
+  p.stop = true;
+  p.reporter.join();
+}
+
+// CHECKPOINT file: header, pairs, done, candidates
+const u64 CHECKPOINT_MAGIC = 0x3154504b434c4648; // "HFLCKPT1"
+const u32 CHECKPOINT_VERSION = 3;
+
+struct checkpoint_header_t{
+  u64 magic;
+  u32 version;
+  u32 n_pairs;
+  u32 rk10_begin, rk10_end;
+  u32 rk9_begin, rk9_end;
+  u64 n_done;
+  u64 n_candidates;
+  u64 candidates_length; // see step3_state_t
+  step3_counters_t cnt;
+};
+
+// a key_candidate_t without padding s.t. equal states give equal files
+struct checkpoint_candidate_t{
+  u32 rk8;
+  u32 rk9;
+  u32 rk10;
+  u8 L_inv_rk7_0;
+  u8 reserved[3];
+};
+
+bool checkpoint_write(const std::string &path, const std::vector<pair_t> &PAIRS, const step3_state_t &state){
+  checkpoint_header_t h = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, (u32) PAIRS.size(), state.rk10_begin, state.rk10_end,
+                           state.rk9_begin, state.rk9_end, state.n_done, state.res.candidates.size(), state.candidates_length, state.res.cnt};
+  std::vector<checkpoint_candidate_t> candidates;
+  for(const key_candidate_t &c : state.res.candidates) candidates.push_back({c.rk8, c.rk9, c.rk10, c.L_inv_rk7_0, {0, 0, 0}});
+  return write_file_atomic(path, {{&h, sizeof(h)}, {PAIRS.data(), PAIRS.size() * sizeof(pair_t)},
+                                  {state.done.data(), state.done.size() * sizeof(u64)},
+                                  {candidates.data(), candidates.size() * sizeof(checkpoint_candidate_t)}});
+}
+
+// state must be initialised with the ranges of the shard, they and the pairs must match the checkpoint
+bool checkpoint_read(const std::string &path, const std::vector<pair_t> &PAIRS, step3_state_t &state){
+  std::vector<u8> buf;
+  if(!read_file(path, buf)) return false;
+  checkpoint_header_t h;
+  std::vector<pair_t> saved_pairs(PAIRS.size());
+  const u64 pairs_size = PAIRS.size() * sizeof(pair_t);
+  const u64 done_size = state.done.size() * sizeof(u64);
+  bool ok = buf.size() >= sizeof(h) + pairs_size;
+  if(ok){
+    memcpy(&h, buf.data(), sizeof(h));
+    memcpy(saved_pairs.data(), buf.data() + sizeof(h), pairs_size);
+  }
+  if(!ok || h.magic != CHECKPOINT_MAGIC || h.version != CHECKPOINT_VERSION ||
+     h.n_pairs != PAIRS.size() || h.rk10_begin != state.rk10_begin || h.rk10_end != state.rk10_end ||
+     h.rk9_begin != state.rk9_begin || h.rk9_end != state.rk9_end ||
+     buf.size() != sizeof(h) + pairs_size + done_size + h.n_candidates * sizeof(checkpoint_candidate_t) ||
+     !same_pairs(PAIRS.data(), saved_pairs.data(), PAIRS.size())){
+    std::cout << "Checkpoint " << path << " does not match this shard and DATA" << std::endl;
+    return false;
+  }
+  const u8 *p = buf.data() + sizeof(h) + pairs_size;
+  memcpy(state.done.data(), p, done_size);
+  state.n_done = h.n_done;
+  state.candidates_length = h.candidates_length;
+  state.res.cnt = h.cnt;
+  state.res.candidates.clear();
+  for(u64 k = 0; k < h.n_candidates; k++){
+    checkpoint_candidate_t c;
+    memcpy(&c, p + done_size + k * sizeof(c), sizeof(c));
+    state.res.candidates.push_back({c.L_inv_rk7_0, c.rk8, c.rk9, c.rk10});
+  }
+  return true;
+}
+
+// the step 2 tables for the input differences deltas (of the pairs of one or
+// more targets): DDTV_out_shifted and one T per input difference, either
+// mapped from the table cache or built from scratch
+struct step2_tables_t{
+  std::vector<u8> deltas;
+  const subset_t (*DDTV_out_shifted)[256][256] = nullptr;
+  mapped_table_t DDTV_out_shifted_map;
+  // T[k] of deltas[k] is used if COMPRESSED_T is 0, CT[k] otherwise
+  const subset_t (*T[255])[3] = {nullptr};
+  arena_t tables; // DDTV_out_shifted and T if built
+  std::vector<mapped_table_t> T_map;
+  std::vector<compressed_T_t> CT;
+};
+
+bool step2_tables_init(step2_tables_t &tab, const std::vector<u8> &deltas){
+  const u32 N = deltas.size();
+  const bool COMPRESSED_T = CONFIG.compressed_t;
+  const char *TABLE_CACHE_DIR = CONFIG.table_cache_dir.c_str();
+  tab.deltas = deltas;
+  tab.T_map.resize(N);
+  tab.CT.resize(N);
+
+  if(CONFIG.table_cache){
+    bool cached = table_cache_map(tab.DDTV_out_shifted_map, TABLE_CACHE_DIR, TABLE_DDTV_OUT_SHIFTED, 0, sizeof(subset_t), 256*256*256);
+    for(u32 k = 0; k < N; k++){
+      if(COMPRESSED_T) cached = cached && table_cache_map_compressed_T(tab.CT[k], TABLE_CACHE_DIR, deltas[k]);
+      else cached = cached && table_cache_map(tab.T_map[k], TABLE_CACHE_DIR, TABLE_T, deltas[k], sizeof(subset_t), 3 << 24);
+    }
+    if(cached){
+      if(CONFIG.huge_pages) std::cout << "Loaded tables from " << TABLE_CACHE_DIR << " to " << arena_pages(tab.DDTV_out_shifted_map.mem) << std::endl;
+      else std::cout << "Mapped tables from " << TABLE_CACHE_DIR << std::endl;
+      tab.DDTV_out_shifted = (const subset_t (*)[256][256]) tab.DDTV_out_shifted_map.data;
+      if(!COMPRESSED_T) for(u32 k = 0; k < N; k++) tab.T[k] = (const subset_t (*)[3]) tab.T_map[k].data;
+    } else {
+      std::cout << "Table cache " << TABLE_CACHE_DIR << " incomplete, building tables" << std::endl;
+      table_cache_unmap(tab.DDTV_out_shifted_map);
+      for(u32 k = 0; k < N; k++){
+        compressed_T_free(tab.CT[k]);
+        table_cache_unmap(tab.T_map[k]);
+      }
+    }
+  }
+
+  if(tab.DDTV_out_shifted == nullptr){
+    // Build DDT with specific values
+    auto DDTV_out = new DDTV_out_t;
+    build_DDTV_out(*DDTV_out);
+
+    arena_init(tab.tables, sizeof(subset_t [256][256][256]) + (COMPRESSED_T ? 0 : N * sizeof(subset_t [1 << 24][3])));
+    auto DDTV_out_shifted_mem = arena_new<subset_t [256][256]>(tab.tables, 256);
+    build_DDTV_out_shifted(DDTV_out_shifted_mem, *DDTV_out);
+
+    auto POSSIBLE_DELTA_Y = new possible_delta_y_t;
+    build_possible_delta_y(*POSSIBLE_DELTA_Y, *DDTV_out);
+
+    if(COMPRESSED_T){
+      // only one full T is alive at any time
+      arena_t T_full_mem;
+      arena_init(T_full_mem, sizeof(subset_t [1 << 24][3]));
+      auto T_full = arena_new<subset_t [3]>(T_full_mem, 1 << 24);
+      for(u32 k = 0; k < N; k++){
+        build_T(T_full, deltas[k], DDTV_out_shifted_mem, *POSSIBLE_DELTA_Y);
+        if(!compress_T(tab.CT[k], T_full)){
+          arena_free(T_full_mem);
+          delete DDTV_out;
+          delete POSSIBLE_DELTA_Y;
+          return false;
+        }
+      }
+      arena_free(T_full_mem);
+    } else {
+      for(u32 k = 0; k < N; k++){
+        auto T_mem = arena_new<subset_t [3]>(tab.tables, 1 << 24);
+        build_T(T_mem, deltas[k], DDTV_out_shifted_mem, *POSSIBLE_DELTA_Y);
+        tab.T[k] = T_mem;
+      }
+    }
+    tab.DDTV_out_shifted = DDTV_out_shifted_mem;
+    std::cout << "Built tables on " << arena_pages(COMPRESSED_T ? tab.CT[0].mem : tab.tables) << std::endl;
+    delete DDTV_out;
+    delete POSSIBLE_DELTA_Y;
+  }
+  if(COMPRESSED_T){
+    for(u32 k = 0; k < N; k++){
+      std::cout << "Compressed T for d = 0x" << std::hex << (u32) deltas[k] << ": " << std::dec << (compressed_T_bytes(tab.CT[k]) >> 20) << " MiB, ";
+      std::cout << "dictionary sizes " << tab.CT[k].dict_size[0] << ", " << tab.CT[k].dict_size[1] << ", " << tab.CT[k].dict_size[2] << std::endl;
+    }
+  }
+  return true;
+}
+
+void step2_tables_free(step2_tables_t &tab){
+  arena_free(tab.tables);
+  table_cache_unmap(tab.DDTV_out_shifted_map);
+  for(u32 k = 0; k < tab.deltas.size(); k++){
+    compressed_T_free(tab.CT[k]);
+    table_cache_unmap(tab.T_map[k]);
+  }
+}
+
+// DDTV_out_shifted and the T of every pair of ctx (tab has their input differences)
+void step3_ctx_tables(step3_ctx_t &ctx, const step2_tables_t &tab, u32 n_pairs){
+  ctx.DDTV_out_shifted = tab.DDTV_out_shifted;
+  for(u32 i = 0; i < n_pairs; i++){
+    const u32 k = std::find(tab.deltas.begin(), tab.deltas.end(), ctx.PAIRS[i].d) - tab.deltas.begin();
+    ctx.T[i] = tab.T[k];
+    ctx.CT[i] = &tab.CT[k];
+  }
+}
+
+u64 splitmix64(u64 &x){
+  u64 z = (x += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+// order of the rk8 filter of step3_back by rejection power, estimated on
+// STEP3_ORDER_SAMPLES wrong guesses, i.e., uniformly random T rows (delta_z7)
+// and byte offsets v8 ^ norm_8 of every pair (the same samples in every run)
+// with ctx in index order (an empty row has empty subsets in all bytes, i.e.,
+// it is rejected like in step3_back): first the pair with the smallest
+// subsets, then greedily the pair that leaves the fewest non-empty
+// intersections (summed over the bytes). One pair order for all bytes keeps the loops of
+// step3_back unrolled with constant indices, the bytes stay in index order
+// (their rejection power is about the same, a run time byte index costs more
+// than it saves). Returns the fraction of the samples surviving all pairs
+// per byte
+const u32 STEP3_ORDER_SAMPLES = 4096;
+
+std::array<double, 3> step3_filter_order(const step3_ctx_t &ctx, u32 n_pairs, bool compressed, u8 *pair_order){
+  const u32 S = STEP3_ORDER_SAMPLES;
+  u64 x = 0x524544524f4c4946; // "FILORDER"
+  std::vector<u32> row(S * n_pairs);
+  std::vector<u8> offset(S * n_pairs);
+  for(u32 k = 0; k < S * n_pairs; k++){
+    row[k] = splitmix64(x) & 0xFFFFFF;
+    offset[k] = (u8) splitmix64(x);
+  }
+  auto subset = [&](u32 s, u32 i, int j) -> const subset_t & {
+    return compressed ? *compressed_T_lookup(*ctx.CT[i], row[s*n_pairs + i], j) : ctx.T[i][row[s*n_pairs + i]][j];
+  };
+
+  // first pair
+  u64 best = ~0ull;
+  for(u32 i = 0; i < n_pairs; i++){
+    u64 size = 0;
+    for(u32 s = 0; s < S; s++) for(int j = 0; j < 3; j++) size += subset_size(subset(s, i, j));
+    if(size < best) best = size, pair_order[0] = i;
+  }
+  // intersection of the pairs so far of sample s and byte j
+  subset_t *cur = new subset_t[3*S];
+  for(u32 s = 0; s < S; s++) for(int j = 0; j < 3; j++) cur[3*s + j] = subset(s, pair_order[0], j);
+  // a = cur of sample s and byte j intersected with pair i, false if a is empty
+  auto intersect = [&](u32 s, u32 i, int j, subset_t &a){
+    a = cur[3*s + j];
+    return subset_intersect_shift(a, subset(s, i, j), offset[s*n_pairs + pair_order[0]] ^ offset[s*n_pairs + i]);
+  };
+  std::vector<bool> used(n_pairs, false);
+  used[pair_order[0]] = true;
+  for(u32 k = 1; k < n_pairs; k++){
+    best = ~0ull;
+    for(u32 i = 0; i < n_pairs; i++){
+      if(used[i]) continue;
+      u64 n = 0;
+      for(u32 s = 0; s < S; s++){
+        for(int j = 0; j < 3; j++){
+          subset_t a;
+          n += intersect(s, i, j, a);
+        }
+      }
+      if(n < best) best = n, pair_order[k] = i;
+    }
+    used[pair_order[k]] = true;
+    for(u32 s = 0; s < S; s++) for(int j = 0; j < 3; j++) intersect(s, pair_order[k], j, cur[3*s + j]);
+  }
+  std::array<double, 3> survive = {0, 0, 0};
+  for(u32 s = 0; s < S; s++) for(int j = 0; j < 3; j++) survive[j] += !subset_is_empty(cur[3*s + j]) / (double) S;
+  delete[] cur;
+  return survive;
+}
+
+// STEP3_FILTER_ORDER for ctx (initialised in index order with the tables),
+// reported if verbose
+void step3_ctx_filter_order(step3_ctx_t &ctx, const std::vector<pair_t> &PAIRS, const step2_tables_t &tables, bool verbose){
+  if(CONFIG.step3_filter_order != "sampled") return;
+  u8 pair_order[MAX_N_PAIRS];
+  const std::array<double, 3> survive = step3_filter_order(ctx, PAIRS.size(), CONFIG.compressed_t, pair_order);
+  step3_ctx_init(ctx, PAIRS, pair_order);
+  step3_ctx_tables(ctx, tables, PAIRS.size());
+  if(!verbose) return;
+  std::cout << "rk8 filter order: pairs";
+  for(u32 i = 0; i < PAIRS.size(); i++) std::cout << " " << (u32) pair_order[i];
+  std::cout << " (surviving samples per byte:" << std::setprecision(3);
+  for(int j = 0; j < 3; j++) std::cout << " " << survive[j];
+  std::cout << std::setprecision(6) << ")" << std::endl;
+}
+
+// step 1 up to the queries: random plaintexts, tweaks and (one byte) input
+// differences, the latter are distinct and non-zero or taken from deltas if
+// given. The plaintexts of pair i are queries 2i and 2i + 1, returns the
+// error of getentropy
+int choose_pairs(std::vector<pair_t> &PAIRS, std::vector<u32> &query_state, std::vector<u64> &query_seed, const std::vector<u8> *deltas){
+  int error = 0;
+  for(u32 i = 0; i < PAIRS.size(); i++){
+    // pick random plaintext, tweak and (one byte) input difference
+    u64 seed = 0;
+    u32 plain = 0;
+    u8 in_diff = 0;
+    error = getentropy(&seed, 8);
+    error = getentropy(&plain, 3);
+    // generate in_diff s.t. in the end N_PAIRS different in_diff are used
+    u8 new_in_diff;
+    do {
+      if(deltas != nullptr){
+        in_diff = (*deltas)[i];
+        break;
+      }
+      error = getentropy(&in_diff, 1);
+      new_in_diff = true;
+      if (in_diff == 0) new_in_diff = false;
+      for(u32 j = 0; j < i; j++){
+        if (in_diff == PAIRS[j].d) new_in_diff = false;
+      }
+    } while (!new_in_diff);
+
+    PAIRS[i].p = plain;
+    PAIRS[i].t = seed;
+    PAIRS[i].d = in_diff;
+    query_state[2*i] = plain;
+    query_seed[2*i] = seed;
+    query_state[2*i + 1] = plain ^ (u32) in_diff;
+    query_seed[2*i + 1] = seed ^ ((u64) in_diff << 40);
+  }
+  return error;
+}
+
+// the correct guess (rk10_, L_inv_rk9_) of step 3 for key (round keys for the
+// tweak seed of the first pair, see CHECK_CORRECT_FIRST)
+void correct_step3_guess(u128 key, u64 seed, u32 &rk10_, u32 &L_inv_rk9_){
+  u32 RK[11] = {0}; key_schedule(RK, key, 0);
+  L_inv_rk9_ = inv_linear_layer(normalize_round_key(RK[9], seed, 9));
+  rk10_ = normalize_round_key_10(RK[10], (u8) linear_layer(L_inv_rk9_), seed);
+}
+
+// correct remaining key bits (u, rk6, k) of step 4 for the seed of the first pair
+void correct_step4_guess(u128 key, u64 seed, u32 correct_guess[3]){
+  u32 RK_0[11] = {0}; key_schedule(RK_0, key, seed);
+  correct_guess[0] = inv_linear_layer(RK_0[7]) & 0xFFFF;
+  correct_guess[1] = RK_0[6];
+  correct_guess[2] = RK_0[5] & 0xFF;
+}
+
+// returns false if the attack could not run (or CANDIDATES is incomplete)
+bool new_attack(){
+  const u32 N_PAIRS = CONFIG.n_pairs;
+  // key and pairs from a previous run (see DATA)
+  const bool have_data = !CONFIG.data.empty() && access(CONFIG.data.c_str(), F_OK) == 0;
+  std::vector<pair_t> PAIRS(N_PAIRS);
+
+  // step 0: fix key
+  // (with ORACLE the key is only known to the oracle, key is 0 then)
+  std::cout << "Step 0: Fix key" << std::endl;
+  int error = 0;
+  u128 key = 0;
+  oracle_t oracle;
+  const bool key_known = CONFIG.oracle.empty();
+  if(!key_known && !oracle_connect(oracle, CONFIG.oracle)) return false;
+  if(have_data){
+    if(!data_read(CONFIG.data, key, PAIRS)) return false;
+    std::cout << "Read " << (key_known ? "key and pairs" : "pairs") << " from " << CONFIG.data << std::endl;
+    if(!key_known) key = 0;
+  } else if(key_known){
+    error = getentropy(&key, 16);
+  }
+  if(error) std::cout << "BAD RNG" << std::endl;
+  if(key_known) std::cout << "master key: 0x" << std::hex << (u64) (key >> 64) << (u64) key << std::endl;
+  else std::cout << "master key: held by the oracle at " << CONFIG.oracle << std::endl;
+  // ROUND KEYS FOR SHORTCUTS later
+  u32 RK[11] = {0}; key_schedule(RK, key, 0);
+  if(key_known){
+    for(int i = 0; i < 11; i++){
+      std::cout << "RK[" << i << "] = 0x" << std::hex << RK[i] << std::endl;
+    }
+    std::cout << "L^(-1)(RK[7])_0 = 0x" << std::hex << (inv_linear_layer(RK[7]) >> 16) << std::endl;
+  }
+  // ---------------------
+  std::cout << std::endl;
+
+  // encryption queries (in CPA setting): state[k] = encrypt(state[k], key, seed[k])
+  // by the ORACLE in one batch or locally
+  auto encrypt_queries = [&](u32 *state, const u64 *seed, u64 n) -> bool {
+    if(!key_known) return oracle_encrypt(oracle, state, seed, n);
+    for(u64 k = 0; k < n; k++) state[k] = encrypt(state[k], key, seed[k]);
+    return true;
+  };
+
+  // step 1: gather data
+  // (in CPA setting)
+  auto start = steady_clock::now();
+  auto attack_start = start;
+  std::cout << "Step 1: Generating data:" << std::endl;
+  // the plaintexts of pair i are queries 2i and 2i + 1
+  std::vector<u32> query_state(2*N_PAIRS);
+  std::vector<u64> query_seed(2*N_PAIRS);
+  if(!have_data) error = choose_pairs(PAIRS, query_state, query_seed, nullptr);
+  if(error) std::cout << "BAD RNG" << std::endl;
+  if(!have_data){
+    if(!encrypt_queries(query_state.data(), query_seed.data(), 2*N_PAIRS)) return false;
+    for(u32 i = 0; i < N_PAIRS; i++){
+      PAIRS[i].c = query_state[2*i];
+      PAIRS[i].c_prime = query_state[2*i + 1];
+    }
+  }
+  if(!have_data && !CONFIG.data.empty() && data_write(CONFIG.data, key, PAIRS)){
+    std::cout << "Wrote " << (key_known ? "key and pairs" : "pairs") << " to " << CONFIG.data << std::endl;
+  }
+  auto stop = steady_clock::now();
+  auto duration = duration_cast<seconds>(stop - start);
+  std::cout << "Took " << std::dec << (2*N_PAIRS) << " queries and " << std::dec << duration.count() << "s" << std::endl;
+  if(oracle.n_batches != 0){
+    std::cout << "Oracle: " << oracle.n_queries << " queries in " << oracle.n_batches << " batches, " << oracle.time.count() / 1000 << "us" << std::endl;
+  }
+  std::cout << std::endl;
+
+
+  // the rows of rk10_ of this shard, resumed from CHECKPOINT if it exists
+  step3_state_t state;
+  const u64 n_rows = CONFIG.max_rk10 - CONFIG.rk10_begin;
+  step3_state_init(state, CONFIG.rk10_begin + n_rows * CONFIG.shard / CONFIG.n_shards,
+                   CONFIG.rk10_begin + n_rows * (CONFIG.shard + 1) / CONFIG.n_shards, CONFIG.rk9_begin, CONFIG.max_rk9);
+  const u64 N_GUESSES = (u64) (state.rk10_end - state.rk10_begin) * (state.rk9_end - state.rk9_begin);
+  if(!CONFIG.checkpoint.empty() && access(CONFIG.checkpoint.c_str(), F_OK) == 0){
+    if(!checkpoint_read(CONFIG.checkpoint, PAIRS, state)) return false;
+    std::cout << "Resuming from " << CONFIG.checkpoint << ": " << std::dec << state.n_done << " of " << (state.rk10_end - state.rk10_begin);
+    std::cout << " rows done, " << state.res.candidates.size() << " candidates" << std::endl;
+    std::cout << std::endl;
+  }
+  candidate_sink_t sink;
+  if(!CONFIG.candidates.empty()){
+    if(!candidate_sink_open(sink, CONFIG.candidates, CONFIG.candidates_format, PAIRS, omp_get_max_threads(), state.n_done != 0, state.candidates_length)) return false;
+    std::cout << "Streaming step 3 candidates to " << CONFIG.candidates << " (" << CONFIG.candidates_format << ")" << std::endl;
+    std::cout << std::endl;
+  }
+
+  perf_counters_t perf;
+  if(CONFIG.perf){
+    perf_open(perf);
+    perf_enable(perf, true);
+  }
+
+  // step 2: precomputations
+  start = steady_clock::now();
+  std::cout << "Step 2: Precomputations" << std::endl;
 
+  std::vector<u8> deltas;
+  for(const pair_t &pair : PAIRS) deltas.push_back(pair.d);
+  step2_tables_t tables;
+  if(!step2_tables_init(tables, deltas)){
+    step2_tables_free(tables);
+    candidate_sink_close(sink);
+    if(CONFIG.perf) perf_close(perf);
+    return false;
+  }
+  stop = steady_clock::now();
+  duration = duration_cast<seconds>(stop - start);
+  std::cout << "Took " << std::dec << duration.count() << "s" << std::endl;
+  if(CONFIG.perf){
+    perf_enable(perf, false);
+    perf_report(perf, "step 2", 0);
+  }
   std::cout << std::endl;
-  std::cout << "FLAGS: " << std::endl;
-  std::cout << "  - CHECK_CORRECT_FIRST: " << CHECK_CORRECT_FIRST << std::endl;
-  std::cout << "  - COUNTERS: " << COUNTERS << std::endl;
-  std::cout << "  - PARALLEL: " << PARALLEL << std::endl;
-  std::cout << "Running the attack " << std::dec << REP << " times..." << std::endl;
+
+  // step 3
+  // enumerate (rk9, rk10) to find candidates ((L^-1 rk7)_0, rk8, rk9, rk10)
+  start = steady_clock::now();
+  std::cout << "Step 3: Identify key candidates" << std::endl;
+
+  std::cout << "Checking rk10 in [0x" << std::hex << state.rk10_begin << ", 0x" << state.rk10_end << ") and rk9 in [0x";
+  std::cout << state.rk9_begin << ", 0x" << state.rk9_end << ")";
+  if(CONFIG.n_shards > 1) std::cout << " (shard " << std::dec << CONFIG.shard << " of " << CONFIG.n_shards << ")";
+  std::cout << ", " << std::dec << N_GUESSES << " of 2**48 candidates for (rk9, rk10)." << std::endl;
+  std::cout << "Using " << N_PAIRS << " pairs." << std::endl;
+
+  step3_ctx_t ctx;
+  step3_ctx_init(ctx, PAIRS, nullptr);
+  step3_ctx_tables(ctx, tables, N_PAIRS);
+  step3_ctx_filter_order(ctx, PAIRS, tables, true);
+  ctx.prefetch = CONFIG.step3_prefetch;
+  const int kernel = step3_kernel_from_name(CONFIG.step3_kernel);
+  const step3_tile_t tile = select_step3_tile(N_PAIRS, CONFIG.counters, CONFIG.compressed_t, kernel);
+  std::cout << "Using the " << CONFIG.step3_kernel << " kernel with " << ISA_NAMES[isa_from_name(CONFIG.step3_isa)] << " " << ISA_SCOPE << "." << std::endl;
+  ctx.sink = nullptr;
+  const int n_threads = omp_get_max_threads();
+  ctx.stats = new step3_stats_t[n_threads];
+  step3_stats_init(ctx.stats, n_threads);
+
+  if(CONFIG.parallel){
+    std::cout << "omp_get_num_procs():   " << omp_get_num_procs() << std::endl;
+    std::cout << "omp_get_max_threads(): " << omp_get_max_threads() << std::endl;
+  }
+
+  // not part of state s.t. it is not counted twice
+  step3_result_t first;
+  if(CONFIG.check_correct_first){
+    // correct guess (round keys for tweak PAIRS[0].t) before the zero guess
+    u32 rk10_, L_inv_rk9_;
+    correct_step3_guess(key, PAIRS[0].t, rk10_, L_inv_rk9_);
+    tile(&ctx, 1, rk10_, rk10_ + 1, L_inv_rk9_, L_inv_rk9_ + 1, &first);
+  }
+  // the candidates of first stay in memory, CANDIDATES gets them with their row
+  if(!CONFIG.candidates.empty()) ctx.sink = &sink;
+
+  if(CONFIG.perf) perf_enable(perf, true);
+  // the tiles of a row are collected in pending, finished rows are merged
+  // into state (s.t. a checkpoint only has whole rows)
+  const std::vector<u64> done_before = state.done;
+  const u64 n_done_before = state.n_done;
+  step3_scheduler_t sched;
+  step3_scheduler_init(sched, n_threads, state.rk10_begin, state.rk10_end, state.rk9_begin, state.rk9_end, &done_before);
+  struct pending_row_t{
+    u32 tiles_done = 0;
+    step3_result_t res;
+  };
+  std::unordered_map<u32, pending_row_t> pending;
+  step3_progress_t progress;
+  const u64 n_rows_left = (state.rk10_end - state.rk10_begin) - n_done_before;
+  step3_progress_start(progress, n_rows_left * sched.tiles_per_row, n_rows_left * (state.rk9_end - state.rk9_begin), ctx.stats, n_threads, start);
+  // the candidates of the finished rows must be on disk before the checkpoint
+  // marks them done (the length also covers some of the pending rows, a
+  // resumed run reports them again)
+  auto save_checkpoint = [&](){
+    if(ctx.sink){
+      if(!candidate_sink_flush(sink)) return false;
+      state.candidates_length = sink.length;
+    }
+    return checkpoint_write(CONFIG.checkpoint, PAIRS, state);
+  };
+  auto last_checkpoint = steady_clock::now();
+  #pragma omp parallel if(CONFIG.parallel)
+  {
+    u64 t;
+    while(step3_scheduler_next(sched, omp_get_thread_num(), t)){
+      u32 rk10_, rk9_begin, rk9_end;
+      step3_scheduler_tile(sched, t, rk10_, rk9_begin, rk9_end);
+      step3_result_t res;
+      tile(&ctx, 1, rk10_, rk10_ + 1, rk9_begin, rk9_end, &res);
+      progress.tiles_done++;
+      progress.guesses_done += rk9_end - rk9_begin;
+      #pragma omp critical(step3_state)
+      {
+        const u32 r = rk10_ - state.rk10_begin;
+        pending_row_t &row = pending[r];
+        step3_result_add(row.res, res);
+        if(++row.tiles_done == sched.tiles_per_row){
+          step3_result_add(state.res, row.res);
+          pending.erase(r);
+          state.done[r / 64] |= 1ull << (r % 64);
+          state.n_done++;
+          if(!CONFIG.checkpoint.empty() && steady_clock::now() - last_checkpoint >= seconds(CONFIG.checkpoint_interval)){
+            if(save_checkpoint()){
+              std::cout << "Checkpoint: " << std::dec << state.n_done << " of " << (state.rk10_end - state.rk10_begin) << " rows" << std::endl;
+            }
+            last_checkpoint = steady_clock::now();
+          }
+        }
+      }
+    }
+  }
+  step3_progress_stop(progress);
+  if(CONFIG.perf) perf_enable(perf, false);
+  if(!CONFIG.checkpoint.empty()) save_checkpoint();
+  const bool sink_ok = candidate_sink_close(sink);
+  stop = steady_clock::now();
+  const step3_counters_t &CNT = state.res.cnt;
+  const u64 N_CHECKED = (state.n_done - n_done_before) * (state.rk9_end - state.rk9_begin);
+  auto duration_ns = duration_cast<nanoseconds>(stop - start);
+  std::cout << "Took      " << std::dec << duration_ns.count() << "ns = " << N_CHECKED << " * " << duration_ns.count()/std::max<u64>(N_CHECKED, 1) << "ns" << std::endl;
+  step3_stats_report(ctx.stats, n_threads, duration_ns);
+  delete[] ctx.stats;
+  if(CONFIG.perf){
+    perf_report(perf, "step 3", N_CHECKED);
+    perf_close(perf);
+  }
+  if(CONFIG.counters){
+    std::cout << "Notice that the timings are effected by the counting! To benchamrk performance set COUTNERS to 0" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Average number of candidaets for rk^{(8)}_0: " << (double) CNT.rk8[0] / N_GUESSES / N_PAIRS << std::endl;
+    std::cout << "Average number of candidaets for rk^{(8)}_1: " << (double) CNT.rk8[1] / N_GUESSES / N_PAIRS << std::endl;
+    std::cout << "Average number of candidaets for rk^{(8)}_2: " << (double) CNT.rk8[2] / N_GUESSES / N_PAIRS << std::endl;
+    std::cout << "Survived rk8 filter: " << (double) CNT.survives_rk8 / N_GUESSES << std::endl;
+    std::cout << "Survived Delta y6 filter: " << (double) CNT.survives_Dy6 / N_GUESSES << std::endl;
+    std::cout << "Survived rk7 filter: " << (double) CNT.survives_rk7 / N_GUESSES << std::endl;
+  }
+  std::vector<key_candidate_t> candidates = first.candidates;
+  candidates.insert(candidates.end(), state.res.candidates.begin(), state.res.candidates.end());
+  if(ctx.sink){
+    // step 4 reads them back (state only has the candidates of earlier runs without CANDIDATES)
+    if(!sink_ok){
+      std::cout << "Writing the candidates to " << CONFIG.candidates << " failed" << std::endl;
+      step2_tables_free(tables);
+      return false;
+    }
+    std::cout << "Wrote " << std::dec << sink.n_written << " candidates to " << CONFIG.candidates << std::endl;
+    if(!candidates_read(CONFIG.candidates, CONFIG.candidates_format, PAIRS, candidates)){
+      step2_tables_free(tables);
+      return false;
+    }
+  } else {
+    for(const key_candidate_t &cand : candidates){
+      std::cout << "Candidate: L_inv_rk7_0 = 0x" << std::hex << (u32) cand.L_inv_rk7_0 << ", rk8 = 0x" << cand.rk8;
+      std::cout << ", rk9 = 0x" << cand.rk9 << ", rk10 = 0x" << cand.rk10 << std::endl;
+    }
+  }
+  std::cout << std::endl;
+
+  step2_tables_free(tables);
+
+  // step 4: brute force the remaining key bits of every candidate
+  start = steady_clock::now();
+  std::cout << "Step 4: Brute force remaining key bits" << std::endl;
+  step4_report_keys(candidates.size());
+  // additional queries (in CPA setting)
+  std::vector<query_t> queries(CONFIG.n_verify);
+  query_state.resize(CONFIG.n_verify);
+  query_seed.resize(CONFIG.n_verify);
+  for(u64 k = 0; k < CONFIG.n_verify; k++){
+    u64 seed = 0;
+    u32 plain = 0;
+    error = getentropy(&seed, 8);
+    error = getentropy(&plain, 3);
+    queries[k].p = query_state[k] = plain;
+    queries[k].t = query_seed[k] = seed;
+  }
+  if(error) std::cout << "BAD RNG" << std::endl;
+  if(!encrypt_queries(query_state.data(), query_seed.data(), CONFIG.n_verify)) return false;
+  for(u64 k = 0; k < CONFIG.n_verify; k++) queries[k].c = query_state[k];
+  oracle_close(oracle);
+  u32 correct_guess[3];
+  correct_step4_guess(key, PAIRS[0].t, correct_guess);
+
+  bool recovered = false;
+  u128 master_key = 0;
+  for(const key_candidate_t &cand : candidates){
+    if(recover_master_key(master_key, cand, PAIRS, queries, CONFIG.check_correct_first ? correct_guess : nullptr)){
+      recovered = true;
+      break;
+    }
+  }
+  stop = steady_clock::now();
+  if(recovered){
+    std::cout << "Recovered master key: 0x" << std::hex << std::setfill('0') << std::setw(16) << (u64) (master_key >> 64) << std::setw(16) << (u64) master_key << std::setfill(' ');
+    if(key_known) std::cout << ((master_key == key) ? " (correct)" : " (WRONG)") << std::endl;
+    else std::cout << " (consistent with all " << (2*N_PAIRS + CONFIG.n_verify) << " oracle queries)" << std::endl;
+  } else {
+    std::cout << "No master key recovered (correct key not among the checked candidates)" << std::endl;
+  }
+  duration = duration_cast<seconds>(stop - start);
+  std::cout << "Took " << std::dec << (2*N_PAIRS + CONFIG.n_verify) << " queries in total and " << duration.count() << "s" << std::endl;
+  std::cout << "Time to key: " << std::dec << duration_cast<seconds>(stop - attack_start).count() << "s";
+  if(step4_is_partial()) std::cout << " (with a partial step 4)";
+  std::cout << std::endl;
+  std::cout << std::endl;
+  return true;
+}
+
+// ./a.out multi-target DATA...: the attack on one key per DATA file (read if
+// it exists, otherwise a new key and pairs are written to it) with a single
+// step 3 enumeration for all targets. New targets use the input differences
+// of the first one s.t. the step 2 tables (one T per distinct input
+// difference) are shared, step3_tile checks every block of guesses for all
+// targets with interleaved T lookups
+void multi_target_attack(const std::vector<std::string> &paths){
+  const u32 N_PAIRS = CONFIG.n_pairs;
+  const u32 K = paths.size();
+  std::vector<u128> keys(K);
+  std::vector<std::vector<pair_t>> PAIRS(K, std::vector<pair_t>(N_PAIRS));
+
+  // step 0 and 1: keys and pairs of the targets
+  auto start = steady_clock::now();
+  auto attack_start = start;
+  std::cout << "Step 0 and 1: Keys and pairs of " << std::dec << K << " targets" << std::endl;
+  int error = 0;
+  std::vector<u8> deltas; // of all targets, distinct
+  for(u32 t = 0; t < K; t++){
+    const bool have_data = access(paths[t].c_str(), F_OK) == 0;
+    if(have_data){
+      if(!data_read(paths[t], keys[t], PAIRS[t])) return;
+    } else {
+      std::vector<u32> query_state(2*N_PAIRS);
+      std::vector<u64> query_seed(2*N_PAIRS);
+      std::vector<u8> deltas_0;
+      for(const pair_t &pair : PAIRS[0]) deltas_0.push_back(pair.d);
+      error |= getentropy(&keys[t], 16);
+      error |= choose_pairs(PAIRS[t], query_state, query_seed, t == 0 ? nullptr : &deltas_0);
+      for(u32 i = 0; i < N_PAIRS; i++){
+        PAIRS[t][i].c = encrypt(query_state[2*i], keys[t], query_seed[2*i]);
+        PAIRS[t][i].c_prime = encrypt(query_state[2*i + 1], keys[t], query_seed[2*i + 1]);
+      }
+      if(!data_write(paths[t], keys[t], PAIRS[t])) return;
+    }
+    std::cout << "Target " << std::dec << t << ": " << (have_data ? "read " : "wrote ") << paths[t] << ", master key 0x" << std::hex;
+    std::cout << std::setfill('0') << std::setw(16) << (u64) (keys[t] >> 64) << std::setw(16) << (u64) keys[t] << std::setfill(' ') << ", d =";
+    for(const pair_t &pair : PAIRS[t]){
+      std::cout << " 0x" << (u32) pair.d;
+      if(std::find(deltas.begin(), deltas.end(), pair.d) == deltas.end()) deltas.push_back(pair.d);
+    }
+    std::cout << std::endl;
+  }
+  if(error) std::cout << "BAD RNG" << std::endl;
+  std::cout << std::endl;
+
+  // step 2: the tables of all distinct input differences
+  std::cout << "Step 2: Precomputations for " << std::dec << deltas.size() << " input differences" << std::endl;
+  step2_tables_t tables;
+  if(!step2_tables_init(tables, deltas)){
+    step2_tables_free(tables);
+    return;
+  }
+  std::cout << "Took " << std::dec << duration_cast<seconds>(steady_clock::now() - start).count() << "s" << std::endl;
+  std::cout << std::endl;
+
+  // step 3: one pass over the guesses of this shard for all targets
+  start = steady_clock::now();
+  std::cout << "Step 3: Identify key candidates" << std::endl;
+  const u64 n_rows = CONFIG.max_rk10 - CONFIG.rk10_begin;
+  const u32 rk10_begin = CONFIG.rk10_begin + n_rows * CONFIG.shard / CONFIG.n_shards;
+  const u32 rk10_end = CONFIG.rk10_begin + n_rows * (CONFIG.shard + 1) / CONFIG.n_shards;
+  const u64 N_GUESSES = (u64) (rk10_end - rk10_begin) * (CONFIG.max_rk9 - CONFIG.rk9_begin);
+  std::cout << "Checking rk10 in [0x" << std::hex << rk10_begin << ", 0x" << rk10_end << ") and rk9 in [0x";
+  std::cout << CONFIG.rk9_begin << ", 0x" << CONFIG.max_rk9 << ")";
+  if(CONFIG.n_shards > 1) std::cout << " (shard " << std::dec << CONFIG.shard << " of " << CONFIG.n_shards << ")";
+  std::cout << ", " << std::dec << N_GUESSES << " of 2**48 candidates for (rk9, rk10) of each of " << K << " targets." << std::endl;
+
+  const int n_threads = omp_get_max_threads();
+  step3_stats_t *stats = new step3_stats_t[n_threads];
+  step3_stats_init(stats, n_threads);
+  std::vector<step3_ctx_t> ctx(K);
+  for(u32 t = 0; t < K; t++){
+    step3_ctx_init(ctx[t], PAIRS[t], nullptr);
+    step3_ctx_tables(ctx[t], tables, N_PAIRS);
+    step3_ctx_filter_order(ctx[t], PAIRS[t], tables, t == 0);
+    ctx[t].prefetch = CONFIG.step3_prefetch;
+    ctx[t].sink = nullptr;
+    ctx[t].stats = stats;
+  }
+  const int kernel = step3_kernel_from_name(CONFIG.step3_kernel);
+  const step3_tile_t tile = select_step3_tile(N_PAIRS, CONFIG.counters, CONFIG.compressed_t, kernel);
+  std::cout << "Using the " << CONFIG.step3_kernel << " kernel with " << ISA_NAMES[isa_from_name(CONFIG.step3_isa)] << " " << ISA_SCOPE << "." << std::endl;
+
+  // first[t] (correct guess of target t) is not counted
+  std::vector<step3_result_t> first(K), results(K);
+  if(CONFIG.check_correct_first){
+    for(u32 t = 0; t < K; t++){
+      u32 rk10_, L_inv_rk9_;
+      correct_step3_guess(keys[t], PAIRS[t][0].t, rk10_, L_inv_rk9_);
+      tile(&ctx[t], 1, rk10_, rk10_ + 1, L_inv_rk9_, L_inv_rk9_ + 1, &first[t]);
+    }
+  }
+
+  perf_counters_t perf;
+  if(CONFIG.perf){
+    perf_open(perf);
+    perf_enable(perf, true);
+  }
+  step3_scheduler_t sched;
+  step3_scheduler_init(sched, n_threads, rk10_begin, rk10_end, CONFIG.rk9_begin, CONFIG.max_rk9, nullptr);
+  step3_progress_t progress;
+  step3_progress_start(progress, (u64) (rk10_end - rk10_begin) * sched.tiles_per_row, N_GUESSES, stats, n_threads, start);
+  #pragma omp parallel if(CONFIG.parallel)
+  {
+    u64 tile_index;
+    while(step3_scheduler_next(sched, omp_get_thread_num(), tile_index)){
+      u32 rk10_, rk9_begin, rk9_end;
+      step3_scheduler_tile(sched, tile_index, rk10_, rk9_begin, rk9_end);
+      std::vector<step3_result_t> res(K);
+      tile(ctx.data(), K, rk10_, rk10_ + 1, rk9_begin, rk9_end, res.data());
+      progress.tiles_done++;
+      progress.guesses_done += rk9_end - rk9_begin;
+      #pragma omp critical(step3_state)
+      for(u32 t = 0; t < K; t++) step3_result_add(results[t], res[t]);
+    }
+  }
+  step3_progress_stop(progress);
+  if(CONFIG.perf) perf_enable(perf, false);
+  auto duration_ns = duration_cast<nanoseconds>(steady_clock::now() - start);
+  std::cout << "Took      " << std::dec << duration_ns.count() << "ns = " << K << " * " << N_GUESSES << " * " << duration_ns.count()/std::max<u64>(K * N_GUESSES, 1) << "ns" << std::endl;
+  // the funnel counts every guess once per target
+  step3_stats_report(stats, n_threads, duration_ns);
+  delete[] stats;
+  if(CONFIG.perf){
+    perf_report(perf, "step 3", K * N_GUESSES);
+    perf_close(perf);
+  }
+  for(u32 t = 0; t < K; t++){
+    std::cout << "Target " << t << ": " << results[t].candidates.size() << " candidates";
+    if(CONFIG.counters){
+      const step3_counters_t &CNT = results[t].cnt;
+      std::cout << ", survived rk8 filter: " << (double) CNT.survives_rk8 / N_GUESSES << ", Delta y6 filter: " << (double) CNT.survives_Dy6 / N_GUESSES;
+      std::cout << ", rk7 filter: " << (double) CNT.survives_rk7 / N_GUESSES;
+    }
+    std::cout << std::endl;
+  }
+  std::cout << std::endl;
+  step2_tables_free(tables);
+
+  // step 4: brute force the remaining key bits of the candidates of every target
+  start = steady_clock::now();
+  std::cout << "Step 4: Brute force remaining key bits" << std::endl;
+  u64 n_candidates = 0;
+  for(u32 t = 0; t < K; t++) n_candidates += first[t].candidates.size() + results[t].candidates.size();
+  step4_report_keys(n_candidates);
+  u32 n_recovered = 0;
+  for(u32 t = 0; t < K; t++){
+    std::vector<key_candidate_t> candidates = first[t].candidates;
+    candidates.insert(candidates.end(), results[t].candidates.begin(), results[t].candidates.end());
+    // additional queries (in CPA setting)
+    std::vector<query_t> queries(CONFIG.n_verify);
+    for(query_t &q : queries){
+      u64 seed = 0;
+      u32 plain = 0;
+      error |= getentropy(&seed, 8);
+      error |= getentropy(&plain, 3);
+      q.p = plain;
+      q.t = seed;
+      q.c = encrypt(plain, keys[t], seed);
+    }
+    u32 correct_guess[3];
+    correct_step4_guess(keys[t], PAIRS[t][0].t, correct_guess);
+    bool recovered = false;
+    u128 master_key = 0;
+    for(const key_candidate_t &cand : candidates){
+      if(recover_master_key(master_key, cand, PAIRS[t], queries, CONFIG.check_correct_first ? correct_guess : nullptr)){
+        recovered = true;
+        break;
+      }
+    }
+    std::cout << "Target " << std::dec << t << ": ";
+    if(recovered){
+      std::cout << "recovered master key 0x" << std::hex << std::setfill('0') << std::setw(16) << (u64) (master_key >> 64) << std::setw(16) << (u64) master_key << std::setfill(' ');
+      std::cout << ((master_key == keys[t]) ? " (correct)" : " (WRONG)") << std::endl;
+      n_recovered++;
+    } else {
+      std::cout << "no master key recovered (" << std::dec << candidates.size() << " candidates)" << std::endl;
+    }
+  }
+  if(error) std::cout << "BAD RNG" << std::endl;
+  std::cout << "Took " << std::dec << duration_cast<seconds>(steady_clock::now() - start).count() << "s" << std::endl;
+  std::cout << "Recovered " << n_recovered << " of " << K << " keys, time to keys: " << duration_cast<seconds>(steady_clock::now() - attack_start).count() << "s";
+  if(step4_is_partial()) std::cout << " (with a partial step 4)";
+  std::cout << std::endl;
+  std::cout << std::endl;
+}
+/////////////////////////////////////////
+// END OF NEW ATTACK                   //
+/////////////////////////////////////////
+
+// this function is used to generate the data for the figure
+// regarding the number of candidates for rk8
+// |RK^{(8)}_j| for one delta and every Delta y_7 = (y_0, y_1, y_2): the sum over
+// the gamma with DDT[delta][gamma] != 0 of DDT[Delta x_7,j][y_j] (j < 3, the
+// other bytes only need a non-zero entry) or of the product of the three
+// entries (j = 3), with Delta x_7 = MC(RR(gamma << 16)) ^ (delta << 8).
+// The 256 Delta y_7 with the same y_0, y_1 are one row of u32 counters that
+// gets all its gammas at once and goes to hist[j][count] right away, i.e.,
+// the 2**24 counters of delta are never stored
+void rk8_candidates_delta(const u32 (*DDT)[256], u32 delta, std::vector<u64> *hist){
+  std::vector<std::array<u8, 3>> delta_x7;
+  for(u32 gamma = 1; gamma < 256; gamma++){
+    if(DDT[delta][gamma] == 0) continue;
+    u32 x = mix_columns(rotate_rows(gamma << 16)) ^ (delta << 8);
+    delta_x7.push_back({(u8) (x >> 16), (u8) (x >> 8), (u8) x});
+  }
+  std::vector<const std::array<u8, 3> *> gammas_0; // the gammas with y_0 possible
+  alignas(64) u32 row[4][256];
+  for(u32 y_0 = 0; y_0 < 256; y_0++){
+    gammas_0.clear();
+    for(const auto &x : delta_x7) if(DDT[x[0]][y_0] != 0) gammas_0.push_back(&x);
+    if(gammas_0.empty()){
+      for(int j = 0; j < 4; j++) hist[j][0] += 1 << 16;
+      continue;
+    }
+    for(u32 y_1 = 0; y_1 < 256; y_1++){
+      memset(row, 0, sizeof(row));
+      for(const std::array<u8, 3> *x : gammas_0){
+        const u32 a_0 = DDT[(*x)[0]][y_0], a_1 = DDT[(*x)[1]][y_1];
+        if(a_1 == 0) continue;
+        const u32 *a_2 = DDT[(*x)[2]];
+        for(u32 y_2 = 0; y_2 < 256; y_2++){
+          const u32 possible = a_2[y_2] != 0;
+          row[0][y_2] += a_0 * possible;
+          row[1][y_2] += a_1 * possible;
+          row[2][y_2] += a_2[y_2];
+          row[3][y_2] += a_0 * a_1 * a_2[y_2];
+        }
+      }
+      for(int j = 0; j < 4; j++){
+        for(u32 y_2 = 0; y_2 < 256; y_2++){
+          const u32 n = row[j][y_2];
+          if(n >= hist[j].size()) hist[j].resize(n + 1, 0);
+          hist[j][n]++;
+        }
+      }
+    }
+  }
+}
+
+// distributions of |RK^{(8)}_j| (j = 0, 1, 2 and j = 3 for all of rk8) over all
+// non-zero delta and all Delta y_7, in parallel over delta with one set of
+// histograms per thread. The summary goes to stdout, the histograms to path
+// (if not empty) as RK8_CANDIDATES_FORMAT (csv: j,n,count per line, json: one
+// object per j)
+void compute_number_of_rk8_candidates(const std::string &path){
+  // for every non-zero delta and every Delta y_7 compute the number of possible rk8
+  std::cout << "Computing distributions of |RK^{(8)}_j|" << std::endl;
+  auto start = steady_clock::now();
+
+  // compute DDT
+  auto DDT = new u32 [256][256]();
+  for(u32 x = 0; x < 256; x++){
+    for(u32 din = 0; din < 256; din++){
+      u32 dout = SBOX[x] ^ SBOX[x ^ din];
+      DDT[din][dout]++;
+    }
+  }
+
+  std::vector<u64> hist[4];
+  #pragma omp parallel if(CONFIG.parallel)
+  {
+    std::vector<u64> hist_thread[4];
+    for(int j = 0; j < 4; j++) hist_thread[j].resize(1, 0);
+    #pragma omp for schedule(dynamic, 1)
+    for(u32 delta = 1; delta < 256; delta++){
+      rk8_candidates_delta(DDT, delta, hist_thread);
+      #pragma omp critical
+      std::cout << "#" << std::flush;
+    }
+    #pragma omp critical
+    for(int j = 0; j < 4; j++){
+      if(hist[j].size() < hist_thread[j].size()) hist[j].resize(hist_thread[j].size(), 0);
+      for(u64 n = 0; n < hist_thread[j].size(); n++) hist[j][n] += hist_thread[j][n];
+    }
+  }
+  delete[] DDT;
+  std::cout << std::endl << "finished computation in " << duration_cast<seconds>(steady_clock::now() - start).count() << "s" << std::endl;
+
+  std::ofstream out;
+  if(!path.empty()){
+    out.open(path);
+    if(!out){
+      std::cout << "Could not open " << path << ": " << strerror(errno) << std::endl;
+      return;
+    }
+    if(CONFIG.rk8_candidates_format == "csv") out << "j,n,count" << std::endl;
+    else out << "[" << std::endl;
+  }
+  for(int j = 0; j < 4; j++){
+    u64 max = 0;
+    double avg = 0;
+    for(u64 n = 0; n < hist[j].size(); n++){
+      if(hist[j][n] == 0) continue;
+      max = n;
+      avg += (double) n * hist[j][n];
+    }
+    avg = avg / ((double) 255 * (1 << 24));
+    std::cout << "j = " << std::dec << j << std::endl;
+    std::cout << "MAX: " << std::dec << max << std::endl;
+    std::cout << "Avg: " << std::dec << avg << std::endl;
+    std::cout << "#Zeros: " << std::dec << hist[j][0] << std::endl;
+    for(u64 n = 0; n < hist[j].size(); n++){
+      if(hist[j][n] == 0) continue;
+      std::cout << "HIST_" << std::dec << j << "[" << n << "] = " << hist[j][n] << std::endl;
+    }
+    if(!out.is_open()) continue;
+    if(CONFIG.rk8_candidates_format == "csv"){
+      for(u64 n = 0; n < hist[j].size(); n++) if(hist[j][n] != 0) out << j << "," << n << "," << hist[j][n] << std::endl;
+    } else {
+      out << "  {\"j\": " << j << ", \"max\": " << max << ", \"avg\": " << avg << ", \"zeros\": " << hist[j][0] << ", \"hist\": {";
+      bool first = true;
+      for(u64 n = 0; n < hist[j].size(); n++){
+        if(hist[j][n] == 0) continue;
+        out << (first ? "" : ", ") << "\"" << n << "\": " << hist[j][n];
+        first = false;
+      }
+      out << "}}" << (j < 3 ? "," : "") << std::endl;
+    }
+  }
+  if(out.is_open()){
+    if(CONFIG.rk8_candidates_format == "json") out << "]" << std::endl;
+    std::cout << "Wrote the histograms to " << path << std::endl;
+  }
+}
+
+// this function precomputes the tables of step 2 for TABLE_CACHE:
+// DDTV_out_shifted and T for the given input differences are written to dir,
+// returns false if dir cannot be created or a table cannot be written
+bool build_table_cache(const char *dir, const std::vector<u8> &deltas){
+  std::cout << "Building table cache in " << dir << std::endl;
+  if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+    std::cout << "Cannot create " << dir << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  auto start = steady_clock::now();
+  auto DDTV_out = new DDTV_out_t;
+  build_DDTV_out(*DDTV_out);
+  arena_t tables;
+  arena_init(tables, sizeof(subset_t [256][256][256]) + sizeof(subset_t [1 << 24][3]));
+  auto DDTV_out_shifted = arena_new<subset_t [256][256]>(tables, 256);
+  build_DDTV_out_shifted(DDTV_out_shifted, *DDTV_out);
+  auto POSSIBLE_DELTA_Y = new possible_delta_y_t;
+  build_possible_delta_y(*POSSIBLE_DELTA_Y, *DDTV_out);
+  delete DDTV_out;
+  bool ok = table_cache_write(dir, TABLE_DDTV_OUT_SHIFTED, 0, DDTV_out_shifted, sizeof(subset_t), 256*256*256);
+  auto duration = duration_cast<seconds>(steady_clock::now() - start);
+  std::cout << "DDTV_out_shifted: took " << std::dec << duration.count() << "s" << std::endl;
+
+  auto T = arena_new<subset_t [3]>(tables, 1 << 24);
+  for(u32 k = 0; ok && k < deltas.size(); k++){
+    const u8 d = deltas[k];
+    start = steady_clock::now();
+    build_T(T, d, DDTV_out_shifted, *POSSIBLE_DELTA_Y);
+    if(CONFIG.compressed_t){
+      compressed_T_t CT;
+      ok = compress_T(CT, T) && table_cache_write_compressed_T(dir, d, CT);
+      compressed_T_free(CT);
+    } else {
+      ok = table_cache_write(dir, TABLE_T, d, T, sizeof(subset_t), 3 << 24);
+    }
+    duration = duration_cast<seconds>(steady_clock::now() - start);
+    std::cout << "T for d = 0x" << std::hex << (u32) d << ": took " << std::dec << duration.count() << "s" << std::endl;
+  }
+  arena_free(tables);
+  delete POSSIBLE_DELTA_Y;
+  return ok;
+}
+
+/////////////////////////////////////////
+// START OF MICROBENCHMARKS            //
+/////////////////////////////////////////
+// ./a.out bench [name ...]: cost per call of the cipher primitives and the
+// subset operations, as the median (and minimum) of BENCH_REP runs of
+// BENCH_N calls after one warm-up run, in ns and in rdtsc ticks (reference
+// cycles, not core cycles). The inputs are the same pseudo-random values in
+// every run and on every machine (splitmix64 with a fixed seed). With
+// BENCH_MODE = throughput the calls are independent, with latency the input
+// of every call depends on the output of the previous one (through an xor
+// with the next input, or through the index of the next input for
+// subset_size and subset_get_elements, which adds a load). BENCH_FORMAT is
+// text or jsonl (one object per benchmark). A portable build calls the
+// subset operations of STEP3_ISA like step 3 does (see subset_backend_t).
+const u64 BENCH_INPUTS = 1024; // power of two, the subsets fill 32 KiB
+
+struct bench_inputs_t{
+  u32 state[BENCH_INPUTS];
+  u128 key[BENCH_INPUTS];
+  u64 seed[BENCH_INPUTS];
+  subset_t subset[BENCH_INPUTS]; // 1 to 16 elements
+};
+
+// (subset_t is returned by value, see subset_intersect for -Wpsabi)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+void bench_inputs_init(bench_inputs_t &in){
+  u64 x = 0x48414c464c4f4f50; // "HALFLOOP"
+  for(u64 i = 0; i < BENCH_INPUTS; i++){
+    in.state[i] = splitmix64(x) & 0xFFFFFF;
+    in.key[i] = ((u128) splitmix64(x) << 64) ^ splitmix64(x);
+    in.seed[i] = splitmix64(x);
+    in.subset[i] = subset_init_empty();
+    const u64 n = 1 + splitmix64(x) % 16;
+    for(u64 k = 0; k < n; k++) in.subset[i] = subset_add_element(in.subset[i], (u8) splitmix64(x));
+  }
+}
+
+// forces x into a register after every call s.t. the compiler can neither
+// drop nor vectorize the calls
+template<typename T> inline void bench_opaque(T &x){ asm volatile("" : "+r"(x)); }
+inline void bench_opaque(subset_t &x){
+#ifdef __AVX__
+  asm volatile("" : "+x"(x));
+#else
+  asm volatile("" : "+m"(x));
+#endif
+}
+
+// F(in, state, i) -> state for functions of a 24 bit state (or round key)
+template<bool LATENCY, typename F>
+u64 bench_loop_state(const bench_inputs_t &in, u64 n){
+  u32 x = 0;
+  for(u64 i = 0; i < n; i++){
+    const u32 s = in.state[i % BENCH_INPUTS];
+    if constexpr (LATENCY) x = F{}(in, x ^ s, i);
+    else x ^= F{}(in, s, i);
+    bench_opaque(x);
+  }
+  return x;
+}
+
+// F(subset, i) -> subset
+template<bool LATENCY, typename F>
+u64 bench_loop_subset(const bench_inputs_t &in, u64 n){
+  subset_t a = in.subset[0];
+  for(u64 i = 0; i < n; i++){
+    if constexpr (LATENCY) a = F{}(a, i);
+    else a ^= F{}(in.subset[i % BENCH_INPUTS], i);
+    bench_opaque(a);
+  }
+  return a[0] ^ a[1] ^ a[2] ^ a[3];
+}
+
+// F(subset) -> u32
+template<bool LATENCY, typename F>
+u64 bench_loop_count(const bench_inputs_t &in, u64 n){
+  u32 c = 0;
+  for(u64 i = 0; i < n; i++){
+    if constexpr (LATENCY) c = F{}(in.subset[(i + c) % BENCH_INPUTS]);
+    else c += F{}(in.subset[i % BENCH_INPUTS]);
+    bench_opaque(c);
+  }
+  return c;
+}
+
+struct bench_t{
+  const char *name;
+  u64 (*run[2])(const bench_inputs_t &in, u64 n); // throughput, latency
+};
+
+template<typename F> bench_t bench_state(const char *name, F){ return {name, {bench_loop_state<false, F>, bench_loop_state<true, F>}}; }
+template<typename F> bench_t bench_subset(const char *name, F){ return {name, {bench_loop_subset<false, F>, bench_loop_subset<true, F>}}; }
+template<typename F> bench_t bench_count(const char *name, F){ return {name, {bench_loop_count<false, F>, bench_loop_count<true, F>}}; }
+
+std::vector<bench_t> benchmarks(){
+  return {
+    bench_state("sub_bytes", [](const bench_inputs_t &, u32 s, u64){ return sub_bytes(s); }),
+    bench_state("inv_sub_bytes", [](const bench_inputs_t &, u32 s, u64){ return inv_sub_bytes(s); }),
+    bench_state("mix_columns", [](const bench_inputs_t &, u32 s, u64){ return mix_columns(s); }),
+    bench_state("inv_mix_columns", [](const bench_inputs_t &, u32 s, u64){ return inv_mix_columns(s); }),
+    bench_state("linear_layer", [](const bench_inputs_t &, u32 s, u64){ return linear_layer(s); }),
+    bench_state("inv_linear_layer", [](const bench_inputs_t &, u32 s, u64){ return inv_linear_layer(s); }),
+    bench_state("encrypt", [](const bench_inputs_t &in, u32 s, u64 i){ return encrypt(s, in.key[i % BENCH_INPUTS], in.seed[i % BENCH_INPUTS]); }),
+    bench_state("decrypt", [](const bench_inputs_t &in, u32 s, u64 i){ return decrypt(s, in.key[i % BENCH_INPUTS], in.seed[i % BENCH_INPUTS]); }),
+    bench_state("key_schedule", [](const bench_inputs_t &in, u32 s, u64 i){
+      u32 rk[11];
+      key_schedule(rk, in.key[i % BENCH_INPUTS] ^ s, in.seed[i % BENCH_INPUTS]);
+      return rk[10];
+    }),
+    // all 256 shifts in turn
+    bench_subset("subset_shift", [](const subset_t &a, u64 i){ return subset_shift(a, (u8) i); }),
+    bench_count("subset_size", [](const subset_t &a){ return (u32) subset_size(a); }),
+    bench_count("subset_get_elements", [](const subset_t &a){
+      u32 sum = 0;
+      for(u8 e : subset_get_elements(a)) sum += e;
+      return sum;
+    }),
+  };
+}
+#pragma GCC diagnostic pop
+
+oracle_t BENCH_ORACLE; // connected by run_benchmarks if ORACLE is set
+
+// n queries to the ORACLE in batches of ORACLE_BATCH (throughput) or one by
+// one, every plaintext depending on the previous ciphertext (latency)
+template<bool LATENCY>
+u64 bench_oracle(const bench_inputs_t &in, u64 n){
+  const u64 batch = LATENCY ? 1 : CONFIG.oracle_batch;
+  std::vector<u32> state(batch);
+  std::vector<u64> seed(batch);
+  u32 c = 0;
+  for(u64 i = 0; i < n; i += batch){
+    const u64 m = std::min(batch, n - i);
+    for(u64 k = 0; k < m; k++){
+      state[k] = in.state[(i + k) % BENCH_INPUTS] ^ c;
+      seed[k] = in.seed[(i + k) % BENCH_INPUTS];
+    }
+    if(!oracle_encrypt(BENCH_ORACLE, state.data(), seed.data(), m)) return 0;
+    c = state[m - 1];
+  }
+  return c;
+}
+
+// result per call
+struct bench_result_t{
+  double ns_median, ns_min;
+  double cycles_median, cycles_min;
+};
+
+volatile u64 bench_sink; // the results of all runs end up here
+
+bench_result_t bench_run(const bench_t &b, bool latency, const bench_inputs_t &in){
+  const u64 n = CONFIG.bench_n, rep = CONFIG.bench_rep;
+  u64 sink = b.run[latency](in, n); // warm-up
+  std::vector<double> ns(rep), cycles(rep);
+  for(u64 r = 0; r < rep; r++){
+    const auto start = steady_clock::now();
+    const u64 t = __rdtsc();
+    sink ^= b.run[latency](in, n);
+    cycles[r] = (double) (__rdtsc() - t) / n;
+    ns[r] = (double) duration_cast<nanoseconds>(steady_clock::now() - start).count() / n;
+  }
+  bench_sink = sink;
+  std::sort(ns.begin(), ns.end());
+  std::sort(cycles.begin(), cycles.end());
+  return {ns[rep / 2], ns[0], cycles[rep / 2], cycles[0]};
+}
+
+// all benchmarks if names is empty, false for an unknown name
+// (with ORACLE also the round trips of queries to the oracle)
+bool run_benchmarks(const std::vector<std::string> &names){
+  std::vector<bench_t> all = benchmarks();
+  if(!CONFIG.oracle.empty()){
+    if(!oracle_connect(BENCH_ORACLE, CONFIG.oracle)) return false;
+    all.push_back({"oracle", {bench_oracle<false>, bench_oracle<true>}});
+  }
+  std::vector<bench_t> selected;
+  for(const std::string &name : names){
+    auto b = std::find_if(all.begin(), all.end(), [&](const bench_t &b){ return name == b.name; });
+    if(b == all.end()){
+      std::cout << "Unknown benchmark: " << name << ", available:";
+      for(const bench_t &b : all) std::cout << " " << b.name;
+      std::cout << std::endl;
+      return false;
+    }
+    selected.push_back(*b);
+  }
+  if(names.empty()) selected = all;
+
+  const bool latency = CONFIG.bench_mode == "latency";
+  const int isa = isa_from_name(CONFIG.step3_isa);
+  auto in = new bench_inputs_t;
+  bench_inputs_init(*in);
+  if(CONFIG.bench_format == "text"){
+    std::cout << "Benchmarks (" << CONFIG.bench_mode << ", " << ISA_NAMES[isa] << " " << ISA_SCOPE << "): median and minimum of " << std::dec << CONFIG.bench_rep;
+    std::cout << " runs of " << CONFIG.bench_n << " calls" << std::endl;
+    std::cout << std::left << std::setw(22) << "name" << std::right << std::setw(12) << "ns/call" << std::setw(12) << "(min)";
+    std::cout << std::setw(12) << "ticks/call" << std::setw(12) << "(min)" << std::endl;
+  }
+  std::cout << std::fixed << std::setprecision(3);
+  for(const bench_t &b : selected){
+    const bench_result_t r = bench_run(b, latency, *in);
+    if(CONFIG.bench_format == "jsonl"){
+      std::cout << "{\"benchmark\":\"" << b.name << "\",\"mode\":\"" << CONFIG.bench_mode << "\",\"isa\":\"" << ISA_NAMES[isa] << "\",";
+      std::cout << "\"calls\":" << CONFIG.bench_n << ",\"rep\":" << CONFIG.bench_rep << ",";
+      std::cout << "\"ns_median\":" << r.ns_median << ",\"ns_min\":" << r.ns_min << ",";
+      std::cout << "\"ticks_median\":" << r.cycles_median << ",\"ticks_min\":" << r.cycles_min << "}" << std::endl;
+    } else {
+      std::cout << std::left << std::setw(22) << b.name << std::right << std::setw(12) << r.ns_median << std::setw(12) << r.ns_min;
+      std::cout << std::setw(12) << r.cycles_median << std::setw(12) << r.cycles_min << std::endl;
+    }
+  }
+  std::cout << std::defaultfloat << std::setprecision(6);
+  delete in;
+  return true;
+}
+
+/////////////////////////////////////////
+// END OF MICROBENCHMARKS              //
+/////////////////////////////////////////
+
+// ./a.out oracle: serve encryption queries on ORACLE with the key of DATA
+// (if it exists, s.t. sharded attacks can share it) or a random key, one
+// thread per client, until killed
+int run_oracle(){
+  u128 key;
+  std::vector<pair_t> PAIRS(CONFIG.n_pairs);
+  if(!CONFIG.data.empty() && access(CONFIG.data.c_str(), F_OK) == 0){
+    if(!data_read(CONFIG.data, key, PAIRS)) return 1;
+    std::cout << "Read key from " << CONFIG.data << std::endl;
+  } else if(getentropy(&key, 16) != 0){
+    std::cout << "BAD RNG" << std::endl;
+    return 1;
+  }
+  std::cout << "master key: 0x" << std::hex << std::setfill('0') << std::setw(16) << (u64) (key >> 64) << std::setw(16) << (u64) key << std::setfill(' ') << std::dec << std::endl;
+
+  sockaddr_un addr;
+  if(!oracle_address(addr, CONFIG.oracle)) return 1;
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(CONFIG.oracle.c_str());
+  if(fd < 0 || bind(fd, (const sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0){
+    std::cout << "Cannot listen on " << CONFIG.oracle << ": " << strerror(errno) << std::endl;
+    return 1;
+  }
+  std::cout << "Oracle listening on " << CONFIG.oracle << std::endl;
+  for(int client = 0; ; ){
+    const int c = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if(c < 0){
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      std::cout << "Oracle accept failed: " << strerror(errno) << std::endl;
+      return 1;
+    }
+    std::thread(oracle_serve, c, key, client++).detach();
+  }
+}
+
+void print_usage(const char *name){
+  std::cout << "usage: " << name << " [options] [mode]" << std::endl;
+  std::cout << "modes:" << std::endl;
+  std::cout << "  (none)                     run the attack REP times" << std::endl;
+  std::cout << "  build-cache [dir [d...]]   precompute the step 2 tables (default: all non-zero d)" << std::endl;
+  std::cout << "  rk8-candidates [file]      generate the data for the figures in the paper (file: RK8_CANDIDATES_FORMAT)" << std::endl;
+  std::cout << "  bench [name...]            microbenchmarks of the cipher and subset primitives (default: all)" << std::endl;
+  std::cout << "  oracle                     serve encryption queries on the socket ORACLE" << std::endl;
+  std::cout << "  multi-target DATA...       attack one key per DATA file with a shared step 3 enumeration" << std::endl;
+  std::cout << "options:" << std::endl;
+  std::cout << "  --config=file              read NAME = value lines from file" << std::endl;
+  std::cout << "  --NAME=value               with NAME and default value:" << std::endl;
+  config_t defaults;
+  for(const config_option_t &o : config_options(defaults)){
+    std::cout << "    " << std::left << std::setw(25) << o.name << std::right;
+    if(o.b != nullptr) std::cout << *o.b;
+    else if(o.n != nullptr) std::cout << std::dec << *o.n;
+    else std::cout << *o.s;
+    std::cout << std::endl;
+  }
+}
+
+int main(int argc, char **argv) {
+  if(!cpu_supports_build()){
+    std::cout << "This CPU lacks instructions this binary was compiled for, compile without -march=native (see top of halfloop.c)" << std::endl;
+    return 1;
+  }
+  std::vector<std::string> args;
+  bool ok = parse_config(CONFIG, argc, argv, args);
+  if(ok && step3_kernel_from_name(CONFIG.step3_kernel) < 0){
+    std::cout << "Unknown STEP3_KERNEL: " << CONFIG.step3_kernel << std::endl;
+    ok = false;
+  }
+  if(ok && CONFIG.step3_filter_order != "fixed" && CONFIG.step3_filter_order != "sampled"){
+    std::cout << "Unknown STEP3_FILTER_ORDER: " << CONFIG.step3_filter_order << std::endl;
+    ok = false;
+  }
+  if(ok && CONFIG.candidates_format != "bin" && CONFIG.candidates_format != "jsonl"){
+    std::cout << "Unknown CANDIDATES_FORMAT: " << CONFIG.candidates_format << std::endl;
+    ok = false;
+  }
+  if(ok && CONFIG.bench_mode != "throughput" && CONFIG.bench_mode != "latency"){
+    std::cout << "Unknown BENCH_MODE: " << CONFIG.bench_mode << std::endl;
+    ok = false;
+  }
+  if(ok && CONFIG.bench_format != "text" && CONFIG.bench_format != "jsonl"){
+    std::cout << "Unknown BENCH_FORMAT: " << CONFIG.bench_format << std::endl;
+    ok = false;
+  }
+  if(ok && CONFIG.rk8_candidates_format != "csv" && CONFIG.rk8_candidates_format != "json"){
+    std::cout << "Unknown RK8_CANDIDATES_FORMAT: " << CONFIG.rk8_candidates_format << std::endl;
+    ok = false;
+  }
+  if(ok && !CONFIG.oracle.empty() && CONFIG.check_correct_first){
+    std::cout << "CHECK_CORRECT_FIRST needs the key, which only the ORACLE knows" << std::endl;
+    ok = false;
+  }
+  if(ok && isa_from_name(CONFIG.step3_isa) < 0){
+    std::cout << "Unknown or unsupported STEP3_ISA: " << CONFIG.step3_isa << std::endl;
+    ok = false;
+  }
+  if(!ok || (!args.empty() && args[0] != "build-cache" && args[0] != "rk8-candidates" && args[0] != "bench" && args[0] != "oracle" && args[0] != "multi-target")){
+    print_usage(argv[0]);
+    return 1;
+  }
+  subset_backend_init(isa_from_name(CONFIG.step3_isa));
+
+  /////////////////
+  test();
+  test_bitsliced();
+  /////////////////
+
+  // precompute the step 2 tables once for TABLE_CACHE:
+  // ./a.out build-cache [dir [d_1 d_2 ...]] (default: all non-zero d)
+  if(!args.empty() && args[0] == "build-cache"){
+    std::string dir = (args.size() > 1) ? args[1] : CONFIG.table_cache_dir;
+    std::vector<u8> deltas;
+    for(u32 k = 2; k < args.size(); k++){
+      char *end;
+      errno = 0;
+      const u64 d = strtoull(args[k].c_str(), &end, 0);
+      if(args[k].empty() || *end != '\0' || errno != 0 || d < 1 || d > 255){
+        std::cout << "Bad input difference: " << args[k] << " (1 <= d <= 255)" << std::endl;
+        return 1;
+      }
+      deltas.push_back(d);
+    }
+    if(deltas.empty()) for(u32 d = 1; d < 256; d++) deltas.push_back(d);
+    return build_table_cache(dir.c_str(), deltas) ? 0 : 1;
+  }
+
+  // generate data for figures in papaer: ./a.out rk8-candidates [file]
+  if(!args.empty() && args[0] == "rk8-candidates"){
+    compute_number_of_rk8_candidates(args.size() > 1 ? args[1] : "");
+    return 0;
+  }
+
+  // encryption oracle for attacks with ORACLE: ./a.out --oracle=path oracle
+  if(!args.empty() && args[0] == "oracle"){
+    if(CONFIG.oracle.empty()){
+      std::cout << "The oracle needs the socket path ORACLE" << std::endl;
+      return 1;
+    }
+    return run_oracle();
+  }
+
+  // microbenchmarks: ./a.out bench [name ...]
+  if(!args.empty() && args[0] == "bench"){
+    std::cout << std::endl;
+    return run_benchmarks(std::vector<std::string>(args.begin() + 1, args.end())) ? 0 : 1;
+  }
+
+  std::cout << std::endl;
+  print_config(CONFIG);
+
+  // several keys at once: ./a.out multi-target DATA_1 DATA_2 ...
+  if(!args.empty() && args[0] == "multi-target"){
+    if(args.size() < 2 || !CONFIG.oracle.empty() || !CONFIG.checkpoint.empty() || !CONFIG.candidates.empty()){
+      std::cout << "multi-target needs at least one DATA file and does not support ORACLE, CHECKPOINT and CANDIDATES" << std::endl;
+      return 1;
+    }
+    std::cout << std::endl;
+    multi_target_attack(std::vector<std::string>(args.begin() + 1, args.end()));
+    return 0;
+  }
+  std::cout << "Running the attack " << std::dec << CONFIG.rep << " times..." << std::endl;
   std::cout << std::endl;
 
   // experimentally verify our new attack
-  for(unsigned int i = 0; i < REP; i++){
+  for(unsigned int i = 0; i < CONFIG.rep; i++){
     std::cout << "Run " << std::dec << i << ":" << std::endl;
-    new_attack();
+    if(!new_attack()) return 1;
   }
   return 0;
 }
+
+#ifdef STEP3_ISA_DISPATCH
+// GCC reports -Wpsabi for the functions that return a subset_t or simd_u32_t
+// here, at the end of the file (see subset_intersect)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif